@@ -0,0 +1,162 @@
+#ifndef CAMERA_PIPE_ARENA_ALLOCATOR_H
+#define CAMERA_PIPE_ARENA_ALLOCATOR_H
+
+#include "HalideRuntime.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+/**
+ * A pool of reusable blocks for the scratch Halide allocates on every call
+ * of a pipeline (the per-strip storage of denoised, deinterleaved, curved
+ * and the demosaic intermediates), installed through the runtime's custom
+ * malloc and free hooks.
+ *
+ * Requests are rounded up to a size class, four per power of two, and freed
+ * blocks go back on their class's free list instead of to the system. A
+ * long-running driver calls the same pipelines on the same frame size, so
+ * once the first frame has populated the free lists every later request is
+ * served from them.
+ *
+ * The hooks are process-wide, so there is a single arena. Allocations come
+ * from the Halide worker threads; one lock covers the free lists, which is
+ * cheap next to the few hundred allocations a frame makes.
+ */
+class ArenaAllocator {
+public:
+    struct Counts {
+        // Requests from Halide, and how many of them reached the system
+        // allocator because their free list was empty.
+        size_t mallocs = 0, system_mallocs = 0;
+        // Bytes held by the arena, whether in use or on a free list.
+        size_t reserved_bytes = 0;
+    };
+
+    static ArenaAllocator &instance() {
+        static ArenaAllocator arena;
+        return arena;
+    }
+
+    void install() {
+        previous_malloc = halide_set_custom_malloc(halide_malloc_hook);
+        previous_free = halide_set_custom_free(halide_free_hook);
+    }
+
+    void uninstall() {
+        halide_set_custom_malloc(previous_malloc);
+        halide_set_custom_free(previous_free);
+    }
+
+    // Without pooling, every free goes straight back to the system, so the
+    // same hooks count allocations for the default behavior.
+    void set_pooling(bool enabled) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pooling = enabled;
+    }
+
+    // Returns every block on a free list to the system.
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < num_classes; i++) {
+            for (void *block : free_lists[i]) {
+                counts.reserved_bytes -= class_size(i);
+                ::free(block);
+            }
+            free_lists[i].clear();
+        }
+    }
+
+    Counts get_counts() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counts;
+    }
+
+    void reset_counts() {
+        std::lock_guard<std::mutex> lock(mutex);
+        counts.mallocs = counts.system_mallocs = 0;
+    }
+
+private:
+    // Halide vectorizes loads and stores over its allocations, so they are
+    // aligned like halide_malloc's. The header holding the block's size
+    // class takes one alignment's worth, keeping the user pointer aligned.
+    static const size_t alignment = 128;
+    static const size_t min_class_bits = 8;
+    static const size_t num_classes = 4 * (64 - min_class_bits);
+
+    // Size class i holds blocks of (4 + i % 4) << (i / 4 + min_class_bits - 2)
+    // bytes, header included.
+    static size_t class_size(size_t i) {
+        return (4 + i % 4) << (i / 4 + min_class_bits - 2);
+    }
+
+    static size_t class_of(size_t bytes) {
+        size_t i = 0;
+        while (i + 1 < num_classes && class_size(i) < bytes) {
+            i++;
+        }
+        return i;
+    }
+
+    static void *halide_malloc_hook(void *user_context, size_t size) {
+        return instance().allocate(size + alignment);
+    }
+
+    static void halide_free_hook(void *user_context, void *ptr) {
+        instance().deallocate(ptr);
+    }
+
+    void *allocate(size_t bytes) {
+        size_t c = class_of(bytes);
+        void *block = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            counts.mallocs++;
+            if (!free_lists[c].empty()) {
+                block = free_lists[c].back();
+                free_lists[c].pop_back();
+            } else {
+                counts.system_mallocs++;
+                counts.reserved_bytes += class_size(c);
+            }
+        }
+        if (!block && posix_memalign(&block, alignment, class_size(c)) != 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            counts.reserved_bytes -= class_size(c);
+            return nullptr;
+        }
+        *(size_t *)block = c;
+        return (uint8_t *)block + alignment;
+    }
+
+    void deallocate(void *ptr) {
+        if (!ptr) {
+            return;
+        }
+        void *block = (uint8_t *)ptr - alignment;
+        size_t c = *(size_t *)block;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pooling) {
+                free_lists[c].push_back(block);
+                return;
+            }
+            counts.reserved_bytes -= class_size(c);
+        }
+        ::free(block);
+    }
+
+    ArenaAllocator() : free_lists(num_classes) {}
+
+    std::mutex mutex;
+    std::vector<std::vector<void *>> free_lists;
+    bool pooling = true;
+    Counts counts;
+    halide_malloc_t previous_malloc = nullptr;
+    halide_free_t previous_free = nullptr;
+};
+
+#endif  // CAMERA_PIPE_ARENA_ALLOCATOR_H
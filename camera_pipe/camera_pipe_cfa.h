@@ -0,0 +1,61 @@
+#ifndef CAMERA_PIPE_CFA_H
+#define CAMERA_PIPE_CFA_H
+
+#include "camera_pipe.h"
+#include "camera_pipe_bggr.h"
+#include "camera_pipe_gbrg.h"
+#include "camera_pipe_rggb.h"
+
+#include <cstring>
+
+/**
+ * camera_pipe for any of the four Bayer layouts. Each layout is its own
+ * build of the generator (cfa_pattern=...), with the phase compiled in, so
+ * choosing one here is the only per-frame cost. Raws are taken as the
+ * sensor delivers them, with no cropping to a common phase.
+ */
+enum class CfaPattern { GRBG, RGGB, BGGR, GBRG };
+
+// Parses a layout name ("rggb", ...). Returns false if it isn't one.
+inline bool parse_cfa_pattern(const char *name, CfaPattern *pattern) {
+    const struct {
+        const char *name;
+        CfaPattern pattern;
+    } names[] = {
+        {"grbg", CfaPattern::GRBG},
+        {"rggb", CfaPattern::RGGB},
+        {"bggr", CfaPattern::BGGR},
+        {"gbrg", CfaPattern::GBRG},
+    };
+    for (const auto &n : names) {
+        if (strcmp(name, n.name) == 0) {
+            *pattern = n.pattern;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Same arguments as camera_pipe, which handles GRBG.
+inline int camera_pipe_cfa(CfaPattern pattern, halide_buffer_t *input,
+                           halide_buffer_t *matrix_3200, halide_buffer_t *matrix_7000,
+                           float color_temp, float gamma, float contrast, float sharpen,
+                           int blackLevel, int whiteLevel, halide_buffer_t *processed) {
+    switch (pattern) {
+    case CfaPattern::RGGB:
+        return camera_pipe_rggb(input, matrix_3200, matrix_7000, color_temp, gamma, contrast,
+                                sharpen, blackLevel, whiteLevel, processed);
+    case CfaPattern::BGGR:
+        return camera_pipe_bggr(input, matrix_3200, matrix_7000, color_temp, gamma, contrast,
+                                sharpen, blackLevel, whiteLevel, processed);
+    case CfaPattern::GBRG:
+        return camera_pipe_gbrg(input, matrix_3200, matrix_7000, color_temp, gamma, contrast,
+                                sharpen, blackLevel, whiteLevel, processed);
+    case CfaPattern::GRBG:
+    default:
+        return camera_pipe(input, matrix_3200, matrix_7000, color_temp, gamma, contrast,
+                           sharpen, blackLevel, whiteLevel, processed);
+    }
+}
+
+#endif  // CAMERA_PIPE_CFA_H
@@ -0,0 +1,51 @@
+#ifndef CAMERA_PIPE_FOLD_H
+#define CAMERA_PIPE_FOLD_H
+
+/**
+ * The rows of storage camera_pipe's manual schedule folds each per-strip
+ * intermediate into. camera_pipe_generator.cpp schedules with these, and
+ * process --memory checks each Func's allocations against them, so the
+ * schedule and the check can't drift apart.
+ */
+
+// The raw as read (unpacked, or merged from a burst) and denoised: the
+// denoiser and deinterleave read 2 rows either side of each row pair.
+const int raw_fold_rows = 16;
+const int denoised_fold_rows = 16;
+const int deinterleaved_fold_rows = 8;
+// Edge-directed's g_r and g_b
+const int demosaic_fold_rows = 4;
+// AHD's intermediates: its full resolution candidates are read 3 rows
+// above and below each output row pair.
+const int ahd_fold_rows = 8;
+// Sharpening reads a row either side of each row pair.
+const int curved_fold_rows = 4;
+
+// What a folded Func should allocate per strip: fold_rows rows of one
+// value per pixel of processed's width (or half of it, for the
+// deinterleaved channels), times the channels stored.
+struct FoldedStorage {
+    const char *func;
+    int fold_rows, channels, bytes_per_value;
+    bool half_width;
+};
+
+// Every folded Func, by name. Malvar has no intermediates to fold.
+const FoldedStorage folded_storage[] = {
+    {"unpacked", raw_fold_rows, 1, 2, false},
+    {"merged", raw_fold_rows, 1, 2, false},
+    {"denoised", denoised_fold_rows, 1, 2, false},
+    {"deinterleaved", deinterleaved_fold_rows, 4, 2, true},
+    {"g_r", demosaic_fold_rows, 1, 2, true},
+    {"g_b", demosaic_fold_rows, 1, 2, true},
+    {"g_r_h", ahd_fold_rows, 1, 2, true},
+    {"g_r_v", ahd_fold_rows, 1, 2, true},
+    {"g_b_h", ahd_fold_rows, 1, 2, true},
+    {"g_b_v", ahd_fold_rows, 1, 2, true},
+    {"rgb_h", ahd_fold_rows, 3, 2, false},
+    {"rgb_v", ahd_fold_rows, 3, 2, false},
+    {"homogeneity_diff", ahd_fold_rows, 1, 1, false},
+    {"curved", curved_fold_rows, 3, 1, false},
+};
+
+#endif  // CAMERA_PIPE_FOLD_H
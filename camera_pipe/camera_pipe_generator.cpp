@@ -2,6 +2,8 @@
 #include <stdint.h>
 #include "halide_trace_config.h"
 
+#include "camera_pipe_fold.h"
+
 namespace {
 
 using std::vector;
@@ -10,7 +12,11 @@ using namespace Halide;
 using namespace Halide::ConciseCasts;
 
 // Shared variables
-Var x, y, c, yi, yo, yii, xi;
+Var x, y, c, n, yi, yo, yii, xi;
+
+// The stages below are written with implicit trailing arguments (_), so the
+// same definitions serve a single frame and a stack of frames with an extra
+// outer dimension.
 
 // Average two positive values rounding up
 Expr avg(Expr a, Expr b) {
@@ -24,28 +30,73 @@ Expr blur121(Expr a, Expr b, Expr c) {
 
 Func interleave_x(Func a, Func b) {
     Func out;
-    out(x, y) = select((x%2)==0, a(x/2, y), b(x/2, y));
+    out(x, y, _) = select((x%2)==0, a(x/2, y, _), b(x/2, y, _));
     return out;
 }
 
 Func interleave_y(Func a, Func b) {
     Func out;
-    out(x, y) = select((y%2)==0, a(x, y/2), b(x, y/2));
+    out(x, y, _) = select((y%2)==0, a(x, y/2, _), b(x, y/2, _));
     return out;
 }
 
+// Demosaicking algorithms. EdgeDirected is the original camera_pipe one.
+// Malvar is the Malvar-He-Cutler linear 5x5 interpolation: cheaper, and free
+// of direction decisions. AHD chooses between a horizontal and a vertical
+// interpolation per pixel by which is more homogeneous around it, in the
+// manner of Hirakawa and Parks: slower, with fewer zippering and false color
+// artifacts.
+enum class DemosaicMethod { EdgeDirected, Malvar, AHD };
+
+const std::map<std::string, DemosaicMethod> demosaic_methods = {
+    {"edge_directed", DemosaicMethod::EdgeDirected},
+    {"malvar", DemosaicMethod::Malvar},
+    {"ahd", DemosaicMethod::AHD},
+};
+
+// Color filter array layouts, named by the colors of the top-left 2x2 cell
+// in reading order. Everything after the raw is read assumes GRBG (the
+// N900's); the others are read starting one column and/or row in, which
+// puts a GRBG cell at the origin.
+enum class CfaPattern { GRBG, RGGB, BGGR, GBRG };
+
+const std::map<std::string, CfaPattern> cfa_patterns = {
+    {"grbg", CfaPattern::GRBG},
+    {"rggb", CfaPattern::RGGB},
+    {"bggr", CfaPattern::BGGR},
+    {"gbrg", CfaPattern::GBRG},
+};
+
 class Demosaic : public Halide::Generator<Demosaic> {
 public:
+    GeneratorParam<DemosaicMethod> method{"method", DemosaicMethod::EdgeDirected, demosaic_methods};
     GeneratorParam<LoopLevel> intermed_compute_at{"intermed_compute_at", LoopLevel::inlined()};
     GeneratorParam<LoopLevel> intermed_store_at{"intermed_store_at", LoopLevel::inlined()};
     GeneratorParam<LoopLevel> output_compute_at{"output_compute_at", LoopLevel::inlined()};
+    // Width the intermediates are vectorized over; 0 for twice the natural vector size
+    GeneratorParam<int> tile_width{"tile_width", 0};
 
-    // Inputs and outputs
-    Input<Func> deinterleaved{ "deinterleaved", Int(16), 3 };
-    Output<Func> output{ "output", Int(16), 3 };
+    // Inputs and outputs. The dimensionality is taken from the Func passed
+    // to apply(): (x, y, c) for one frame, plus any trailing batch dimensions.
+    Input<Func> deinterleaved{ "deinterleaved", Int(16) };
+    Output<Func> output{ "output", Int(16) };
 
     // Defines outputs using inputs
     void generate() {
+        switch ((DemosaicMethod)method) {
+        case DemosaicMethod::EdgeDirected:
+            edge_directed();
+            break;
+        case DemosaicMethod::Malvar:
+            malvar();
+            break;
+        case DemosaicMethod::AHD:
+            ahd();
+            break;
+        }
+    }
+
+    void edge_directed() {
         // These are the values we already know from the input
         // x_y = the value of channel x at a site in the input of channel y
         // gb refers to green sites in the blue rows
@@ -54,50 +105,50 @@ public:
         // Give more convenient names to the four channels we know
         Func r_r, g_gr, g_gb, b_b;
 
-        g_gr(x, y) = deinterleaved(x, y, 0);
-        r_r(x, y)  = deinterleaved(x, y, 1);
-        b_b(x, y)  = deinterleaved(x, y, 2);
-        g_gb(x, y) = deinterleaved(x, y, 3);
+        g_gr(x, y, _) = deinterleaved(x, y, 0, _);
+        r_r(x, y, _)  = deinterleaved(x, y, 1, _);
+        b_b(x, y, _)  = deinterleaved(x, y, 2, _);
+        g_gb(x, y, _) = deinterleaved(x, y, 3, _);
 
         // These are the ones we need to interpolate
-        Func b_r, g_r, b_gr, r_gr, b_gb, r_gb, r_b, g_b;
+        Func b_r, g_r("g_r"), b_gr, r_gr, b_gb, r_gb, r_b, g_b("g_b");
 
         // First calculate green at the red and blue sites
 
         // Try interpolating vertically and horizontally. Also compute
         // differences vertically and horizontally. Use interpolation in
         // whichever direction had the smallest difference.
-        Expr gv_r  = avg(g_gb(x, y-1), g_gb(x, y));
-        Expr gvd_r = absd(g_gb(x, y-1), g_gb(x, y));
-        Expr gh_r  = avg(g_gr(x+1, y), g_gr(x, y));
-        Expr ghd_r = absd(g_gr(x+1, y), g_gr(x, y));
+        Expr gv_r  = avg(g_gb(x, y-1, _), g_gb(x, y, _));
+        Expr gvd_r = absd(g_gb(x, y-1, _), g_gb(x, y, _));
+        Expr gh_r  = avg(g_gr(x+1, y, _), g_gr(x, y, _));
+        Expr ghd_r = absd(g_gr(x+1, y, _), g_gr(x, y, _));
 
-        g_r(x, y)  = select(ghd_r < gvd_r, gh_r, gv_r);
+        g_r(x, y, _)  = select(ghd_r < gvd_r, gh_r, gv_r);
 
-        Expr gv_b  = avg(g_gr(x, y+1), g_gr(x, y));
-        Expr gvd_b = absd(g_gr(x, y+1), g_gr(x, y));
-        Expr gh_b  = avg(g_gb(x-1, y), g_gb(x, y));
-        Expr ghd_b = absd(g_gb(x-1, y), g_gb(x, y));
+        Expr gv_b  = avg(g_gr(x, y+1, _), g_gr(x, y, _));
+        Expr gvd_b = absd(g_gr(x, y+1, _), g_gr(x, y, _));
+        Expr gh_b  = avg(g_gb(x-1, y, _), g_gb(x, y, _));
+        Expr ghd_b = absd(g_gb(x-1, y, _), g_gb(x, y, _));
 
-        g_b(x, y)  = select(ghd_b < gvd_b, gh_b, gv_b);
+        g_b(x, y, _)  = select(ghd_b < gvd_b, gh_b, gv_b);
 
         // Next interpolate red at gr by first interpolating, then
         // correcting using the error green would have had if we had
         // interpolated it in the same way (i.e. add the second derivative
         // of the green channel at the same place).
         Expr correction;
-        correction = g_gr(x, y) - avg(g_r(x, y), g_r(x-1, y));
-        r_gr(x, y) = correction + avg(r_r(x-1, y), r_r(x, y));
+        correction = g_gr(x, y, _) - avg(g_r(x, y, _), g_r(x-1, y, _));
+        r_gr(x, y, _) = correction + avg(r_r(x-1, y, _), r_r(x, y, _));
 
         // Do the same for other reds and blues at green sites
-        correction = g_gr(x, y) - avg(g_b(x, y), g_b(x, y-1));
-        b_gr(x, y) = correction + avg(b_b(x, y), b_b(x, y-1));
+        correction = g_gr(x, y, _) - avg(g_b(x, y, _), g_b(x, y-1, _));
+        b_gr(x, y, _) = correction + avg(b_b(x, y, _), b_b(x, y-1, _));
 
-        correction = g_gb(x, y) - avg(g_r(x, y), g_r(x, y+1));
-        r_gb(x, y) = correction + avg(r_r(x, y), r_r(x, y+1));
+        correction = g_gb(x, y, _) - avg(g_r(x, y, _), g_r(x, y+1, _));
+        r_gb(x, y, _) = correction + avg(r_r(x, y, _), r_r(x, y+1, _));
 
-        correction = g_gb(x, y) - avg(g_b(x, y), g_b(x+1, y));
-        b_gb(x, y) = correction + avg(b_b(x, y), b_b(x+1, y));
+        correction = g_gb(x, y, _) - avg(g_b(x, y, _), g_b(x+1, y, _));
+        b_gb(x, y, _) = correction + avg(b_b(x, y, _), b_b(x+1, y, _));
 
         // Now interpolate diagonally to get red at blue and blue at
         // red. Hold onto your hats; this gets really fancy. We do the
@@ -108,41 +159,38 @@ public:
         // sites - we correct our interpolations using the second
         // derivative of green at the same sites.
 
-        correction = g_b(x, y)  - avg(g_r(x, y), g_r(x-1, y+1));
-        Expr rp_b  = correction + avg(r_r(x, y), r_r(x-1, y+1));
-        Expr rpd_b = absd(r_r(x, y), r_r(x-1, y+1));
+        correction = g_b(x, y, _)  - avg(g_r(x, y, _), g_r(x-1, y+1, _));
+        Expr rp_b  = correction + avg(r_r(x, y, _), r_r(x-1, y+1, _));
+        Expr rpd_b = absd(r_r(x, y, _), r_r(x-1, y+1, _));
 
-        correction = g_b(x, y)  - avg(g_r(x-1, y), g_r(x, y+1));
-        Expr rn_b  = correction + avg(r_r(x-1, y), r_r(x, y+1));
-        Expr rnd_b = absd(r_r(x-1, y), r_r(x, y+1));
+        correction = g_b(x, y, _)  - avg(g_r(x-1, y, _), g_r(x, y+1, _));
+        Expr rn_b  = correction + avg(r_r(x-1, y, _), r_r(x, y+1, _));
+        Expr rnd_b = absd(r_r(x-1, y, _), r_r(x, y+1, _));
 
-        r_b(x, y)  = select(rpd_b < rnd_b, rp_b, rn_b);
+        r_b(x, y, _)  = select(rpd_b < rnd_b, rp_b, rn_b);
 
         // Same thing for blue at red
-        correction = g_r(x, y)  - avg(g_b(x, y), g_b(x+1, y-1));
-        Expr bp_r  = correction + avg(b_b(x, y), b_b(x+1, y-1));
-        Expr bpd_r = absd(b_b(x, y), b_b(x+1, y-1));
+        correction = g_r(x, y, _)  - avg(g_b(x, y, _), g_b(x+1, y-1, _));
+        Expr bp_r  = correction + avg(b_b(x, y, _), b_b(x+1, y-1, _));
+        Expr bpd_r = absd(b_b(x, y, _), b_b(x+1, y-1, _));
 
-        correction = g_r(x, y)  - avg(g_b(x+1, y), g_b(x, y-1));
-        Expr bn_r  = correction + avg(b_b(x+1, y), b_b(x, y-1));
-        Expr bnd_r = absd(b_b(x+1, y), b_b(x, y-1));
+        correction = g_r(x, y, _)  - avg(g_b(x+1, y, _), g_b(x, y-1, _));
+        Expr bn_r  = correction + avg(b_b(x+1, y, _), b_b(x, y-1, _));
+        Expr bnd_r = absd(b_b(x+1, y, _), b_b(x, y-1, _));
 
-        b_r(x, y)  =  select(bpd_r < bnd_r, bp_r, bn_r);
+        b_r(x, y, _)  =  select(bpd_r < bnd_r, bp_r, bn_r);
 
         // Resulting color channels
         Func r, g, b;
 
         // Interleave the resulting channels
-        r = interleave_y(interleave_x(r_gr, r_r),
-                         interleave_x(r_b, r_gb));
-        g = interleave_y(interleave_x(g_gr, g_r),
-                         interleave_x(g_b, g_gb));
-        b = interleave_y(interleave_x(b_gr, b_r),
-                         interleave_x(b_b, b_gb));
+        r = interleave_sites(r_gr, r_r, r_b, r_gb);
+        g = interleave_sites(g_gr, g_r, g_b, g_gb);
+        b = interleave_sites(b_gr, b_r, b_b, b_gb);
 
-        output(x, y, c) = select(c == 0, r(x, y),
-                                 c == 1, g(x, y),
-                                         b(x, y));
+        output(x, y, c, _) = select(c == 0, r(x, y, _),
+                                    c == 1, g(x, y, _),
+                                            b(x, y, _));
 
         // These are the stencil stages we want to schedule
         // separately. Everything else we'll just inline.
@@ -150,6 +198,142 @@ public:
         intermediates.push_back(g_b);
     }
 
+    void malvar() {
+        // Each missing value is a fixed 5x5 filter of the mosaic around its
+        // site: a bilinear estimate plus a gain times the Laplacian of the
+        // channel that is known there. Coefficients are in sixteenths.
+        const vector<Tap> g_at_rb = {
+            {0, 0, 8},
+            {-1, 0, 4}, {1, 0, 4}, {0, -1, 4}, {0, 1, 4},
+            {-2, 0, -2}, {2, 0, -2}, {0, -2, -2}, {0, 2, -2}};
+        // At a green site, for the color whose neighbors are to the left and right
+        const vector<Tap> along_row = {
+            {0, 0, 10},
+            {-1, 0, 8}, {1, 0, 8}, {-2, 0, -2}, {2, 0, -2},
+            {-1, -1, -2}, {1, -1, -2}, {-1, 1, -2}, {1, 1, -2},
+            {0, -2, 1}, {0, 2, 1}};
+        // At a green site, for the color whose neighbors are above and below
+        const vector<Tap> along_column = {
+            {0, 0, 10},
+            {0, -1, 8}, {0, 1, 8}, {0, -2, -2}, {0, 2, -2},
+            {-1, -1, -2}, {1, -1, -2}, {-1, 1, -2}, {1, 1, -2},
+            {-2, 0, 1}, {2, 0, 1}};
+        // Red at blue sites and blue at red sites
+        const vector<Tap> diagonal = {
+            {0, 0, 12},
+            {-1, -1, 4}, {1, -1, 4}, {-1, 1, 4}, {1, 1, 4},
+            {-2, 0, -3}, {2, 0, -3}, {0, -2, -3}, {0, 2, -3}};
+
+        Func g_gr, r_r, b_b, g_gb;
+        g_gr(x, y, _) = deinterleaved(x, y, 0, _);
+        r_r(x, y, _)  = deinterleaved(x, y, 1, _);
+        b_b(x, y, _)  = deinterleaved(x, y, 2, _);
+        g_gb(x, y, _) = deinterleaved(x, y, 3, _);
+
+        Func r_gr, b_gr, g_r, b_r, g_b, r_b, r_gb, b_gb;
+        r_gr(x, y, _) = filter(0, 0, along_row);
+        b_gr(x, y, _) = filter(0, 0, along_column);
+        g_r(x, y, _)  = filter(1, 0, g_at_rb);
+        b_r(x, y, _)  = filter(1, 0, diagonal);
+        g_b(x, y, _)  = filter(0, 1, g_at_rb);
+        r_b(x, y, _)  = filter(0, 1, diagonal);
+        r_gb(x, y, _) = filter(1, 1, along_column);
+        b_gb(x, y, _) = filter(1, 1, along_row);
+
+        Func r = interleave_sites(r_gr, r_r, r_b, r_gb);
+        Func g = interleave_sites(g_gr, g_r, g_b, g_gb);
+        Func b = interleave_sites(b_gr, b_r, b_b, b_gb);
+
+        output(x, y, c, _) = select(c == 0, r(x, y, _),
+                                    c == 1, g(x, y, _),
+                                            b(x, y, _));
+
+        // The filters read the deinterleaved channels directly, which are
+        // already stored per strip, so Malvar has no intermediates:
+        // intermed_compute_at, intermed_store_at and the fold have nothing
+        // to apply to, and only output_compute_at schedules it.
+    }
+
+    void ahd() {
+        // Green at red and blue sites, interpolated horizontally and
+        // vertically, each corrected by the second derivative of the
+        // known color along the same direction.
+        auto directional_green = [&](int ox, int oy, int dx, int dy) {
+            Expr e = (2 * (wide(ox, oy, -dx, -dy) + wide(ox, oy, dx, dy)) + 2 * wide(ox, oy, 0, 0) -
+                      wide(ox, oy, -2*dx, -2*dy) - wide(ox, oy, 2*dx, 2*dy) + 2) >> 2;
+            return cast<int16_t>(e);
+        };
+        Func g_r_h("g_r_h"), g_r_v("g_r_v"), g_b_h("g_b_h"), g_b_v("g_b_v");
+        g_r_h(x, y, _) = directional_green(1, 0, 1, 0);
+        g_r_v(x, y, _) = directional_green(1, 0, 0, 1);
+        g_b_h(x, y, _) = directional_green(0, 1, 1, 0);
+        g_b_v(x, y, _) = directional_green(0, 1, 0, 1);
+
+        Func rgb_h = ahd_candidate("rgb_h", g_r_h, g_b_h);
+        Func rgb_v = ahd_candidate("rgb_v", g_r_v, g_b_v);
+
+        // Luminance and the two color differences of each candidate
+        auto lum = [&](Func f, Expr px, Expr py) {
+            return cast<int32_t>(f(px, py, 0, _)) + 2 * f(px, py, 1, _) + f(px, py, 2, _);
+        };
+        auto chroma_distance = [&](Func f, Expr x0, Expr y0, Expr x1, Expr y1) {
+            Expr dr = (cast<int32_t>(f(x0, y0, 0, _)) - f(x0, y0, 1, _)) -
+                      (cast<int32_t>(f(x1, y1, 0, _)) - f(x1, y1, 1, _));
+            Expr db = (cast<int32_t>(f(x0, y0, 2, _)) - f(x0, y0, 1, _)) -
+                      (cast<int32_t>(f(x1, y1, 2, _)) - f(x1, y1, 1, _));
+            return max(abs(dr), abs(db));
+        };
+
+        // Adaptive thresholds: the smaller of the two candidates' worst
+        // differences along their own interpolation direction. AHD measures
+        // these in CIELab; luminance and color differences are a good
+        // enough proxy at this bit depth and cost no divisions or cube roots.
+        Expr eps_lum = min(max(absd(lum(rgb_h, x - 1, y), lum(rgb_h, x, y)),
+                               absd(lum(rgb_h, x + 1, y), lum(rgb_h, x, y))),
+                           max(absd(lum(rgb_v, x, y - 1), lum(rgb_v, x, y)),
+                               absd(lum(rgb_v, x, y + 1), lum(rgb_v, x, y))));
+        Expr eps_chroma = min(max(chroma_distance(rgb_h, x - 1, y, x, y),
+                                  chroma_distance(rgb_h, x + 1, y, x, y)),
+                              max(chroma_distance(rgb_v, x, y - 1, x, y),
+                                  chroma_distance(rgb_v, x, y + 1, x, y)));
+
+        // How many of the four neighbors are close to the pixel in
+        // both luminance and color, for either candidate.
+        auto homogeneity = [&](Func f) {
+            Expr count = 0;
+            const int offsets[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+            for (const auto &o : offsets) {
+                Expr xn = x + o[0], yn = y + o[1];
+                Expr close = (absd(lum(f, xn, yn), lum(f, x, y)) <= eps_lum &&
+                              chroma_distance(f, xn, yn, x, y) <= eps_chroma);
+                count += select(close, 1, 0);
+            }
+            return count;
+        };
+
+        // Only which candidate is more homogeneous matters, so keep the
+        // difference of the two counts.
+        Func homogeneity_diff("homogeneity_diff");
+        homogeneity_diff(x, y, _) = cast<int8_t>(homogeneity(rgb_h) - homogeneity(rgb_v));
+
+        RDom box(-1, 3, -1, 3);
+        Expr votes = sum(cast<int16_t>(homogeneity_diff(x + box.x, y + box.y, _)));
+        output(x, y, c, _) = select(votes > 0, rgb_h(x, y, c, _),
+                                    votes < 0, rgb_v(x, y, c, _),
+                                    avg(rgb_h(x, y, c, _), rgb_v(x, y, c, _)));
+
+        intermediates.push_back(g_r_h);
+        intermediates.push_back(g_r_v);
+        intermediates.push_back(g_b_h);
+        intermediates.push_back(g_b_v);
+        intermediates.push_back(rgb_h);
+        intermediates.push_back(rgb_v);
+        intermediates.push_back(homogeneity_diff);
+        // rgb_h and rgb_v are full resolution and are read 3 rows above and
+        // below each output row pair.
+        fold_factor = ahd_fold_rows;
+    }
+
     void schedule() {
         Pipeline p(output);
 
@@ -161,15 +345,18 @@ public:
             } else if (get_target().has_feature(Target::HVX_128)) {
                 vec = 64;
             }
+            int width = tile_width > 0 ? (int)tile_width : 2*vec;
             for (Func f : intermediates) {
                 f.compute_at(intermed_compute_at)
                     .store_at(intermed_store_at)
-                    .vectorize(x, 2*vec, TailStrategy::RoundUp)
-                    .fold_storage(y, 4);
+                    .vectorize(x, width, TailStrategy::RoundUp)
+                    .fold_storage(y, fold_factor);
+            }
+            if ((DemosaicMethod)method == DemosaicMethod::EdgeDirected) {
+                intermediates[1].compute_with(
+                    intermediates[0], x,
+                    {{x, LoopAlignStrategy::AlignStart}, {y, LoopAlignStrategy::AlignStart}});
             }
-            intermediates[1].compute_with(
-                intermediates[0], x,
-                {{x, LoopAlignStrategy::AlignStart}, {y, LoopAlignStrategy::AlignStart}});
             output.compute_at(output_compute_at)
                 .vectorize(x)
                 .unroll(y)
@@ -197,81 +384,242 @@ public:
     }
 
 private:
+    struct Tap {
+        int dx, dy, weight;
+    };
+
+    // The raw sample at offset (dx, dy) from the site at offset (ox, oy)
+    // in block (x, y) of the mosaic. e.g. mosaic(1, 0, -1, 0) is the green
+    // to the left of the red in block (x, y).
+    Expr mosaic(int ox, int oy, int dx, int dy) {
+        // Offsets may be negative, so round the block down explicitly.
+        int sx = ox + dx, sy = oy + dy;
+        int bx = sx >= 0 ? sx / 2 : -((1 - sx) / 2);
+        int by = sy >= 0 ? sy / 2 : -((1 - sy) / 2);
+        const int channel[2][2] = {{0, 1}, {2, 3}};
+        return deinterleaved(x + bx, y + by, channel[sy - 2*by][sx - 2*bx], _);
+    }
+
+    Expr wide(int ox, int oy, int dx, int dy) {
+        return cast<int32_t>(mosaic(ox, oy, dx, dy));
+    }
+
+    // Applies taps in sixteenths around the site at (ox, oy).
+    Expr filter(int ox, int oy, const vector<Tap> &taps) {
+        Expr total = 0;
+        for (const Tap &t : taps) {
+            total += t.weight * wide(ox, oy, t.dx, t.dy);
+        }
+        return cast<int16_t>((total + 8) >> 4);
+    }
+
+    // Full resolution channel from its values at the four sites of each block.
+    Func interleave_sites(Func gr, Func r, Func b, Func gb) {
+        return interleave_y(interleave_x(gr, r), interleave_x(b, gb));
+    }
+
+    // A full RGB image given green at the red and blue sites, filling in
+    // red and blue by interpolating their difference from that green.
+    Func ahd_candidate(const std::string &name, Func g_r, Func g_b) {
+        Func g_gr, r_r, b_b, g_gb;
+        g_gr(x, y, _) = deinterleaved(x, y, 0, _);
+        r_r(x, y, _)  = deinterleaved(x, y, 1, _);
+        b_b(x, y, _)  = deinterleaved(x, y, 2, _);
+        g_gb(x, y, _) = deinterleaved(x, y, 3, _);
+
+        // Red minus green and blue minus green where red and blue are known
+        Func rd, bd;
+        rd(x, y, _) = cast<int32_t>(r_r(x, y, _)) - g_r(x, y, _);
+        bd(x, y, _) = cast<int32_t>(b_b(x, y, _)) - g_b(x, y, _);
+
+        Func r_gr, r_b, r_gb, b_gr, b_r, b_gb;
+        r_gr(x, y, _) = cast<int16_t>(g_gr(x, y, _) + ((rd(x - 1, y, _) + rd(x, y, _)) >> 1));
+        r_gb(x, y, _) = cast<int16_t>(g_gb(x, y, _) + ((rd(x, y, _) + rd(x, y + 1, _)) >> 1));
+        r_b(x, y, _)  = cast<int16_t>(g_b(x, y, _) + ((rd(x - 1, y, _) + rd(x, y, _) +
+                                                       rd(x - 1, y + 1, _) + rd(x, y + 1, _)) >> 2));
+        b_gr(x, y, _) = cast<int16_t>(g_gr(x, y, _) + ((bd(x, y - 1, _) + bd(x, y, _)) >> 1));
+        b_gb(x, y, _) = cast<int16_t>(g_gb(x, y, _) + ((bd(x, y, _) + bd(x + 1, y, _)) >> 1));
+        b_r(x, y, _)  = cast<int16_t>(g_r(x, y, _) + ((bd(x, y - 1, _) + bd(x + 1, y - 1, _) +
+                                                       bd(x, y, _) + bd(x + 1, y, _)) >> 2));
+
+        Func r = interleave_sites(r_gr, r_r, r_b, r_gb);
+        Func g = interleave_sites(g_gr, g_r, g_b, g_gb);
+        Func b = interleave_sites(b_gr, b_r, b_b, b_gb);
+
+        Func rgb(name);
+        rgb(x, y, c, _) = select(c == 0, r(x, y, _),
+                                 c == 1, g(x, y, _),
+                                         b(x, y, _));
+        return rgb;
+    }
+
     // Intermediate stencil stages to schedule
     vector<Func> intermediates;
+    // Rows of storage to fold each intermediate into
+    int fold_factor = demosaic_fold_rows;
 };
 
-class CameraPipe : public Halide::Generator<CameraPipe> {
+// The stages and the manual strip schedule shared by every variant of the
+// camera pipe. The variants below declare their own Inputs and Outputs, so
+// each keeps its own calling convention, and assemble the pipeline from
+// these pieces.
+template<typename T>
+class CameraPipeBase : public Halide::Generator<T> {
 public:
     // Parameterized output type, because LLVM PTX (GPU) backend does not
     // currently allow 8-bit computations
     GeneratorParam<Type> result_type{"result_type", UInt(8)};
 
-    Input<Buffer<uint16_t>> input{"input", 2};
-    Input<Buffer<float>> matrix_3200{"matrix_3200", 2};
-    Input<Buffer<float>> matrix_7000{"matrix_7000", 2};
-    Input<float> color_temp{"color_temp"};
-    Input<float> gamma{"gamma"};
-    Input<float> contrast{"contrast"};
-    Input<float> sharpen_strength{"sharpen_strength"};
-    Input<int> blackLevel{"blackLevel"};
-    Input<int> whiteLevel{"whiteLevel"};
-
-    Output<Buffer<uint8_t>> processed{"processed", 3};
-
-    void generate();
-
-private:
-
+    GeneratorParam<DemosaicMethod> demosaic_method{"demosaic_method", DemosaicMethod::EdgeDirected,
+                                                   demosaic_methods};
+
+    // The sensor's CFA layout. Each pattern is a separate build; the phase
+    // is a constant offset folded into the first read of the raw.
+    GeneratorParam<CfaPattern> cfa_pattern{"cfa_pattern", CfaPattern::GRBG, cfa_patterns};
+
+    // The manual schedule's shape on targets other than HVX: rows of output
+    // per parallel strip, and the width of the tiles the stages are
+    // vectorized over (0 for twice the natural vector size). The defaults
+    // suit a typical desktop; camera_pipe_tune finds the best for a machine.
+    GeneratorParam<int> strip_size{"strip_size", 32};
+    GeneratorParam<int> tile_width{"tile_width", 0};
+
+    // Accept any output rectangle, such as a digital zoom crop, rather than
+    // a whole frame sized in multiples of 32: the output's min may be
+    // anywhere and its extent as small as a pixel, so the output is neither
+    // bounded nor rounded up to whole tiles and strips.
+    GeneratorParam<bool> roi{"roi", false};
+
+protected:
+    // The raw as signed values, shifted inwards by 16, 12 (plus the CFA
+    // phase) so the stencils never read out of bounds.
+    Func shift(Func raw);
     Func hot_pixel_suppression(Func input);
     Func deinterleave(Func raw);
-    Func apply_curve(Func input);
-    Func color_correct(Func input);
-    Func sharpen(Func input);
+    Func demosaic(Func deinterleaved);
+    Func color_matrix(Func matrix_3200, Func matrix_7000, Expr color_temp);
+    Func color_correct(Func input, Func matrix);
+    Func tone_curve(Expr gamma, Expr contrast, Expr blackLevel, Expr whiteLevel);
+    Func apply_curve(Func input, Func curve);
+    Func sharpen(Func input, Expr sharpen_strength);
+
+    // Runs everything from the shifted, signed raw through sharpening.
+    Func process(Func shifted, Func matrix, Func curve, Expr sharpen_strength);
+
+    // The manual schedule: processed is computed in parallel strips of rows,
+    // with every intermediate stored per strip and folded. If batched,
+    // processed has a trailing frame dimension n which is fused with the
+    // strips before parallelizing.
+    void schedule_strips(Func processed, Expr out_width, Expr out_height, bool batched);
+
+    // Strip height used by schedule_strips, in output rows. Always even.
+    Expr strip_rows(Expr out_height);
+    // Tile width used by schedule_strips, in pixels.
+    int tile_columns();
+
+    // The default schedule assumes the output is a whole number of default
+    // tiles (twice the natural vector size) wide and of 32-row strips tall,
+    // so tiles and strips that divide those are known to divide the output.
+    // Only then can the schedule round up to them and bound the output to a
+    // whole number.
+    // Never true for roi builds.
+    bool tiles_divide_output();
+    bool strips_divide_output();
+
+    // The part of schedule_strips for the stages before sharpening: they are
+    // computed at compute_at, which should cover two rows, and stored per
+    // strip at store_at. For variants whose outputs aren't just the RGB image.
+    void schedule_stages(LoopLevel compute_at, LoopLevel store_at);
+
+    // How much to upsample the tone curve LUT by when sampling it.
+    int lut_resample();
+    int vector_size();
+
+    // The stages the manual schedule needs a handle on
+    Func denoised, deinterleaved, corrected, curved;
+    std::unique_ptr<Demosaic> demosaiced;
 };
 
-Func CameraPipe::hot_pixel_suppression(Func input) {
+template<typename T>
+Func CameraPipeBase<T>::shift(Func raw) {
+    int dx = 0, dy = 0;
+    switch ((CfaPattern)cfa_pattern) {
+    case CfaPattern::GRBG:
+        break;
+    case CfaPattern::RGGB:
+        dx = 1;
+        break;
+    case CfaPattern::BGGR:
+        dy = 1;
+        break;
+    case CfaPattern::GBRG:
+        dx = 1;
+        dy = 1;
+        break;
+    }
+
+    Func shifted("shifted");
+    shifted(x, y, _) = cast<int16_t>(raw(x + 16 + dx, y + 12 + dy, _));
+    return shifted;
+}
+
+template<typename T>
+Func CameraPipeBase<T>::hot_pixel_suppression(Func input) {
 
-    Expr a = max(input(x - 2, y), input(x + 2, y),
-                 input(x, y - 2), input(x, y + 2));
+    Expr a = max(input(x - 2, y, _), input(x + 2, y, _),
+                 input(x, y - 2, _), input(x, y + 2, _));
 
-    Func denoised;
-    denoised(x, y) = clamp(input(x, y), 0, a);
+    Func denoised("denoised");
+    denoised(x, y, _) = clamp(input(x, y, _), 0, a);
 
     return denoised;
 }
 
-Func CameraPipe::deinterleave(Func raw) {
+template<typename T>
+Func CameraPipeBase<T>::deinterleave(Func raw) {
     // Deinterleave the color channels
     Func deinterleaved("deinterleaved");
 
-    deinterleaved(x, y, c) = select(c == 0, raw(2*x, 2*y),
-                                    c == 1, raw(2*x+1, 2*y),
-                                    c == 2, raw(2*x, 2*y+1),
-                                            raw(2*x+1, 2*y+1));
+    deinterleaved(x, y, c, _) = select(c == 0, raw(2*x, 2*y, _),
+                                       c == 1, raw(2*x+1, 2*y, _),
+                                       c == 2, raw(2*x, 2*y+1, _),
+                                               raw(2*x+1, 2*y+1, _));
     return deinterleaved;
 }
 
+template<typename T>
+Func CameraPipeBase<T>::demosaic(Func deinterleaved) {
+    demosaiced = this->template create<Demosaic>();
+    demosaiced->method.set(demosaic_method);
+    demosaiced->tile_width.set(tile_columns());
+    demosaiced->apply(deinterleaved);
+    return demosaiced->output;
+}
 
-
-Func CameraPipe::color_correct(Func input) {
+template<typename T>
+Func CameraPipeBase<T>::color_matrix(Func matrix_3200, Func matrix_7000, Expr color_temp) {
     // Get a color matrix by linearly interpolating between two
     // calibrated matrices using inverse kelvin.
     Expr kelvin = color_temp;
 
-    Func matrix;
+    Func matrix("matrix");
     Expr alpha = (1.0f/kelvin - 1.0f/3200) / (1.0f/7000 - 1.0f/3200);
     Expr val =  (matrix_3200(x, y) * alpha + matrix_7000(x, y) * (1 - alpha));
     matrix(x, y) = cast<int16_t>(val * 256.0f); // Q8.8 fixed point
 
-    if (!auto_schedule) {
+    if (!this->auto_schedule) {
         matrix.compute_root();
     }
 
-    Func corrected;
-    Expr ir = cast<int32_t>(input(x, y, 0));
-    Expr ig = cast<int32_t>(input(x, y, 1));
-    Expr ib = cast<int32_t>(input(x, y, 2));
+    return matrix;
+}
+
+template<typename T>
+Func CameraPipeBase<T>::color_correct(Func input, Func matrix) {
+    Func corrected("corrected");
+    Expr ir = cast<int32_t>(input(x, y, 0, _));
+    Expr ig = cast<int32_t>(input(x, y, 1, _));
+    Expr ib = cast<int32_t>(input(x, y, 2, _));
 
     Expr r = matrix(3, 0) + matrix(0, 0) * ir + matrix(1, 0) * ig + matrix(2, 0) * ib;
     Expr g = matrix(3, 1) + matrix(0, 1) * ir + matrix(1, 1) * ig + matrix(2, 1) * ib;
@@ -280,29 +628,44 @@ Func CameraPipe::color_correct(Func input) {
     r = cast<int16_t>(r/256);
     g = cast<int16_t>(g/256);
     b = cast<int16_t>(b/256);
-    corrected(x, y, c) = select(c == 0, r,
-                                c == 1, g,
-                                        b);
+    corrected(x, y, c, _) = select(c == 0, r,
+                                   c == 1, g,
+                                           b);
 
     return corrected;
 }
 
-Func CameraPipe::apply_curve(Func input) {
+template<typename T>
+int CameraPipeBase<T>::lut_resample() {
+    if (this->get_target().features_any_of({Target::HVX_64, Target::HVX_128})) {
+        // On HVX, LUT lookups are much faster if they are to LUTs not
+        // greater than 256 elements, so we reduce the tonemap to 256
+        // elements and use linear interpolation to upsample it.
+        return 8;
+    }
+    return 1;
+}
+
+template<typename T>
+int CameraPipeBase<T>::vector_size() {
+    int vec = this->get_target().natural_vector_size(UInt(16));
+    if (this->get_target().has_feature(Target::HVX_64)) {
+        vec = 32;
+    } else if (this->get_target().has_feature(Target::HVX_128)) {
+        vec = 64;
+    }
+    return vec;
+}
+
+template<typename T>
+Func CameraPipeBase<T>::tone_curve(Expr gamma, Expr contrast, Expr blackLevel, Expr whiteLevel) {
     // copied from FCam
     Func curve("curve");
 
     Expr minRaw = 0 + blackLevel;
     Expr maxRaw = whiteLevel;
 
-    // How much to upsample the LUT by when sampling it.
-    int lutResample = 1;
-    if (get_target().features_any_of({Target::HVX_64, Target::HVX_128})) {
-        // On HVX, LUT lookups are much faster if they are to LUTs not
-        // greater than 256 elements, so we reduce the tonemap to 256
-        // elements and use linear interpolation to upsample it.
-        lutResample = 8;
-    }
-
+    int lutResample = lut_resample();
     minRaw /= lutResample;
     maxRaw /= lutResample;
 
@@ -324,7 +687,7 @@ Func CameraPipe::apply_curve(Func input) {
     // makeLUT add guard band outside of (minRaw, maxRaw]:
     curve(x) = select(x <= minRaw, 0, select(x > maxRaw, 255, val));
 
-    if (!auto_schedule) {
+    if (!this->auto_schedule) {
         // It's a LUT, compute it once ahead of time.
         curve.compute_root();
     }
@@ -337,29 +700,36 @@ Func CameraPipe::apply_curve(Func input) {
         curve.add_trace_tag(cfg.to_trace_tag());
     }
 
-    Func curved;
+    return curve;
+}
+
+template<typename T>
+Func CameraPipeBase<T>::apply_curve(Func input, Func curve) {
+    Func curved("curved");
 
+    int lutResample = lut_resample();
     if (lutResample == 1) {
         // Use clamp to restrict size of LUT as allocated by compute_root
-        curved(x, y, c) = curve(clamp(input(x, y, c), 0, 1023));
+        curved(x, y, c, _) = curve(clamp(input(x, y, c, _), 0, 1023));
     } else {
         // Use linear interpolation to sample the LUT.
-        Expr in = input(x, y, c);
+        Expr in = input(x, y, c, _);
         Expr u0 = in/lutResample;
         Expr u = in%lutResample;
         Expr y0 = curve(clamp(u0, 0, 127));
         Expr y1 = curve(clamp(u0 + 1, 0, 127));
-        curved(x, y, c) = cast<uint8_t>((cast<uint16_t>(y0)*lutResample + (y1 - y0)*u)/lutResample);
+        curved(x, y, c, _) = cast<uint8_t>((cast<uint16_t>(y0)*lutResample + (y1 - y0)*u)/lutResample);
     }
 
     return curved;
 }
 
-Func CameraPipe::sharpen(Func input) {
+template<typename T>
+Func CameraPipeBase<T>::sharpen(Func input, Expr sharpen_strength) {
     // Convert the sharpening strength to 2.5 fixed point. This allows sharpening in the range [0, 4].
     Func sharpen_strength_x32("sharpen_strength_x32");
     sharpen_strength_x32() = u8_sat(sharpen_strength * 32);
-    if (!auto_schedule) {
+    if (!this->auto_schedule) {
         sharpen_strength_x32.compute_root();
     }
 
@@ -373,48 +743,431 @@ Func CameraPipe::sharpen(Func input) {
 
     // Make an unsharp mask by blurring in y, then in x.
     Func unsharp_y("unsharp_y");
-    unsharp_y(x, y, c) = blur121(input(x, y - 1, c), input(x, y, c), input(x, y + 1, c));
+    unsharp_y(x, y, c, _) = blur121(input(x, y - 1, c, _), input(x, y, c, _), input(x, y + 1, c, _));
 
     Func unsharp("unsharp");
-    unsharp(x, y, c) = blur121(unsharp_y(x - 1, y, c), unsharp_y(x, y, c), unsharp_y(x + 1, y, c));
+    unsharp(x, y, c, _) = blur121(unsharp_y(x - 1, y, c, _), unsharp_y(x, y, c, _), unsharp_y(x + 1, y, c, _));
 
     Func mask("mask");
-    mask(x, y, c) = cast<int16_t>(input(x, y, c)) - cast<int16_t>(unsharp(x, y, c));
+    mask(x, y, c, _) = cast<int16_t>(input(x, y, c, _)) - cast<int16_t>(unsharp(x, y, c, _));
 
     // Weight the mask with the sharpening strength, and add it to the
     // input to get the sharpened result.
     Func sharpened("sharpened");
-    sharpened(x, y, c) = u8_sat(input(x, y, c) + (mask(x, y, c) * sharpen_strength_x32()) / 32);
+    sharpened(x, y, c, _) = u8_sat(input(x, y, c, _) + (mask(x, y, c, _) * sharpen_strength_x32()) / 32);
 
     return sharpened;
 }
 
+template<typename T>
+Func CameraPipeBase<T>::process(Func shifted, Func matrix, Func curve, Expr sharpen_strength) {
+    denoised = hot_pixel_suppression(shifted);
+
+    deinterleaved = deinterleave(denoised);
+
+    Func demosaiced_output = demosaic(deinterleaved);
+
+    corrected = color_correct(demosaiced_output, matrix);
+
+    curved = apply_curve(corrected, curve);
+
+    return sharpen(curved, sharpen_strength);
+}
+
+template<typename T>
+Expr CameraPipeBase<T>::strip_rows(Expr out_height) {
+    // In HVX 128, we need 2 threads to saturate HVX with work,
+    //and in HVX 64 we need 4 threads, and on other devices,
+    // we might need many threads.
+    Expr rows;
+    if (this->get_target().has_feature(Target::HVX_128)) {
+        rows = out_height / 2;
+    } else if (this->get_target().has_feature(Target::HVX_64)) {
+        rows = out_height / 4;
+    } else {
+        rows = std::max(2, (int)strip_size);
+    }
+    return (rows / 2) * 2;
+}
+
+template<typename T>
+int CameraPipeBase<T>::tile_columns() {
+    if (tile_width > 0 && !this->get_target().features_any_of({Target::HVX_64, Target::HVX_128})) {
+        return tile_width;
+    }
+    return 2 * vector_size();
+}
+
+template<typename T>
+bool CameraPipeBase<T>::tiles_divide_output() {
+    return !roi && (2 * vector_size()) % tile_columns() == 0;
+}
+
+template<typename T>
+bool CameraPipeBase<T>::strips_divide_output() {
+    int rows = std::max(2, (int)strip_size / 2 * 2);
+    return !roi && (this->get_target().features_any_of({Target::HVX_64, Target::HVX_128}) || 32 % rows == 0);
+}
+
+template<typename T>
+void CameraPipeBase<T>::schedule_strips(Func processed, Expr out_width, Expr out_height, bool batched) {
+    Expr strip_size = strip_rows(out_height);
+
+    int width = tile_columns();
+    TailStrategy tail = tiles_divide_output() ? TailStrategy::RoundUp : TailStrategy::ShiftInwards;
+    // An ROI may be narrower than a tile or shorter than a strip, which
+    // shifting inwards can't handle.
+    TailStrategy row_tail = TailStrategy::RoundUp, strip_tail = TailStrategy::Auto;
+    if (roi) {
+        tail = row_tail = strip_tail = TailStrategy::GuardWithIf;
+    }
+    processed.compute_root()
+        .reorder(c, x, y)
+        .split(y, yi, yii, 2, row_tail)
+        .split(yi, yo, yi, strip_size / 2, strip_tail)
+        .vectorize(x, width, tail)
+        .unroll(c);
+    if (batched) {
+        // Strips of every frame go into one parallel loop, so a batch of
+        // small frames still fills all the cores.
+        processed.fuse(yo, n, yo);
+    }
+    processed.parallel(yo);
+
+    schedule_stages(LoopLevel(processed, yi), LoopLevel(processed, yo));
+
+    if (this->get_target().features_any_of({Target::HVX_64, Target::HVX_128})) {
+        processed.hexagon();
+    }
+
+    // We can generate slightly better code if we know the splits divide the extent.
+    processed.bound(c, 0, 3);
+    if (tiles_divide_output()) {
+        processed.bound(x, 0, ((out_width)/width)*width);
+    }
+    if (strips_divide_output()) {
+        processed.bound(y, 0, (out_height/strip_size)*strip_size);
+    }
+
+    /* Optional tags to specify layout for HalideTraceViz */
+    {
+        Halide::Trace::FuncConfig cfg;
+        cfg.max = 1024;
+        cfg.pos = { 305, 360 };
+        cfg.labels = {{"denoised"}};
+        denoised.add_trace_tag(cfg.to_trace_tag());
+
+        cfg.pos = { 580, 120 };
+        const int y_offset = 220;
+        cfg.strides = {{1, 0}, {0, 1}, {0, y_offset}};
+        cfg.labels = {
+            { "gr", { 0, 0 * y_offset } },
+            { "r",  { 0, 1 * y_offset }},
+            { "b",  { 0, 2 * y_offset }},
+            { "gb", { 0, 3 * y_offset }},
+        };
+        deinterleaved.add_trace_tag(cfg.to_trace_tag());
+
+        cfg.color_dim = 2;
+        cfg.strides = {{1, 0}, {0, 1}, {0, 0}};
+        cfg.pos = { 1140, 360 };
+        cfg.labels = {{"demosaiced"}};
+        processed.add_trace_tag(cfg.to_trace_tag());
+
+        cfg.pos = { 1400, 360 };
+        cfg.labels = {{"color-corrected"}};
+        corrected.add_trace_tag(cfg.to_trace_tag());
+
+        cfg.max = 256;
+        cfg.pos = { 1660, 360 };
+        cfg.labels = {{"gamma-corrected"}};
+        curved.add_trace_tag(cfg.to_trace_tag());
+    }
+}
+
+template<typename T>
+void CameraPipeBase<T>::schedule_stages(LoopLevel compute_at, LoopLevel store_at) {
+    int vec = vector_size();
+    int width = tile_columns();
+    denoised.compute_at(compute_at).store_at(store_at)
+        .fold_storage(y, denoised_fold_rows)
+        .tile(x, y, x, y, xi, yi, width, 2)
+        .vectorize(xi)
+        .unroll(yi);
+
+    deinterleaved.compute_at(compute_at).store_at(store_at)
+        .fold_storage(y, deinterleaved_fold_rows)
+        .reorder(c, x, y)
+        .vectorize(x, width, TailStrategy::RoundUp)
+        .unroll(c);
+
+    curved.compute_at(compute_at).store_at(store_at)
+        .fold_storage(y, curved_fold_rows)
+        .reorder(c, x, y)
+        .tile(x, y, x, y, xi, yi, width, 2, TailStrategy::RoundUp)
+        .vectorize(xi)
+        .unroll(yi)
+        .unroll(c);
+    corrected.compute_at(curved, x)
+        .reorder(c, x, y)
+        .vectorize(x)
+        .unroll(c);
+
+    demosaiced->intermed_compute_at.set(compute_at);
+    demosaiced->intermed_store_at.set(store_at);
+    demosaiced->output_compute_at.set({curved, x});
+
+    if (this->get_target().features_any_of({Target::HVX_64, Target::HVX_128})) {
+        denoised.align_storage(x, vec);
+        deinterleaved.align_storage(x, vec);
+        corrected.align_storage(x, vec);
+    }
+}
+
+class CameraPipe : public CameraPipeBase<CameraPipe> {
+public:
+    Input<Buffer<uint16_t>> input{"input", 2};
+    Input<Buffer<float>> matrix_3200{"matrix_3200", 2};
+    Input<Buffer<float>> matrix_7000{"matrix_7000", 2};
+    Input<float> color_temp{"color_temp"};
+    Input<float> gamma{"gamma"};
+    Input<float> contrast{"contrast"};
+    Input<float> sharpen_strength{"sharpen_strength"};
+    Input<int> blackLevel{"blackLevel"};
+    Input<int> whiteLevel{"whiteLevel"};
+
+    Output<Buffer<uint8_t>> processed{"processed", 3};
+
+    void generate();
+};
+
 void CameraPipe::generate() {
     // shift things inwards to give us enough padding on the
     // boundaries so that we don't need to check bounds. We're going
     // to make a 2560x1920 output image, just like the FCam pipe, so
     // shift by 16, 12. We also convert it to be signed, so we can deal
     // with values that fall below 0 during processing.
-    Func shifted;
-    shifted(x, y) = cast<int16_t>(input(x+16, y+12));
+    Func shifted = shift(input);
 
-    Func denoised = hot_pixel_suppression(shifted);
+    Func matrix = color_matrix(matrix_3200, matrix_7000, color_temp);
 
-    Func deinterleaved = deinterleave(denoised);
+    Func curve = tone_curve(gamma, contrast, blackLevel, whiteLevel);
 
-    auto demosaiced = create<Demosaic>();
-    demosaiced->apply(deinterleaved);
+    processed(x, y, c) = process(shifted, matrix, curve, sharpen_strength)(x, y, c);
+
+    // Schedule
+    if (auto_schedule) {
+        input.dim(0).set_bounds_estimate(0, 2592);
+        input.dim(1).set_bounds_estimate(0, 1968);
+
+        matrix_3200.dim(0).set_bounds_estimate(0, 4);
+        matrix_3200.dim(1).set_bounds_estimate(0, 3);
+        matrix_7000.dim(0).set_bounds_estimate(0, 4);
+        matrix_7000.dim(1).set_bounds_estimate(0, 3);
+
+        processed
+            .estimate(c, 0, 3)
+            .estimate(x, 0, 2592)
+            .estimate(y, 0, 1968);
+
+    } else {
+        schedule_strips(processed, processed.width(), processed.height(), false);
+
+        denoised.prefetch(input, y, 2);
+
+        /* Optional tags to specify layout for HalideTraceViz */
+        {
+            Halide::Trace::FuncConfig cfg;
+            cfg.max = 1024;
+            cfg.pos = { 10, 348 };
+            cfg.labels = {{"input"}};
+            input.add_trace_tag(cfg.to_trace_tag());
+        }
+    }
+};
+
+// camera_pipe over a stack of frames: input is (x, y, frame) and processed is
+// (x, y, c, frame). The tone curve and color matrix are computed once for the
+// whole batch, and the strips of all frames share one parallel loop.
+class CameraPipeBatch : public CameraPipeBase<CameraPipeBatch> {
+public:
+    Input<Buffer<uint16_t>> input{"input", 3};
+    Input<Buffer<float>> matrix_3200{"matrix_3200", 2};
+    Input<Buffer<float>> matrix_7000{"matrix_7000", 2};
+    Input<float> color_temp{"color_temp"};
+    Input<float> gamma{"gamma"};
+    Input<float> contrast{"contrast"};
+    Input<float> sharpen_strength{"sharpen_strength"};
+    Input<int> blackLevel{"blackLevel"};
+    Input<int> whiteLevel{"whiteLevel"};
+
+    Output<Buffer<uint8_t>> processed{"processed", 4};
+
+    void generate();
+};
 
-    Func corrected = color_correct(demosaiced->output);
+void CameraPipeBatch::generate() {
+    // Same 16, 12 shift as the single frame pipe, per frame.
+    Func shifted = shift(input);
 
-    Func curved = apply_curve(corrected);
+    Func matrix = color_matrix(matrix_3200, matrix_7000, color_temp);
 
-    processed(x, y, c) = sharpen(curved)(x, y, c);
+    Func curve = tone_curve(gamma, contrast, blackLevel, whiteLevel);
+
+    processed(x, y, c, n) = process(shifted, matrix, curve, sharpen_strength)(x, y, c, n);
 
     // Schedule
     if (auto_schedule) {
         input.dim(0).set_bounds_estimate(0, 2592);
         input.dim(1).set_bounds_estimate(0, 1968);
+        input.dim(2).set_bounds_estimate(0, 4);
+
+        matrix_3200.dim(0).set_bounds_estimate(0, 4);
+        matrix_3200.dim(1).set_bounds_estimate(0, 3);
+        matrix_7000.dim(0).set_bounds_estimate(0, 4);
+        matrix_7000.dim(1).set_bounds_estimate(0, 3);
+
+        processed
+            .estimate(c, 0, 3)
+            .estimate(x, 0, 2592)
+            .estimate(y, 0, 1968)
+            .estimate(n, 0, 4);
+    } else {
+        schedule_strips(processed, processed.width(), processed.height(), true);
+
+        denoised.prefetch(input, y, 2);
+    }
+};
+
+// Bakes the tone curve LUT and the Q8.8 color matrix that camera_pipe
+// otherwise rebuilds on every call. They only depend on parameters that
+// rarely change between frames, so a host can cache them and feed them to
+// camera_pipe_prebaked below.
+class CameraPipeLuts : public CameraPipeBase<CameraPipeLuts> {
+public:
+    Input<Buffer<float>> matrix_3200{"matrix_3200", 2};
+    Input<Buffer<float>> matrix_7000{"matrix_7000", 2};
+    Input<float> color_temp{"color_temp"};
+    Input<float> gamma{"gamma"};
+    Input<float> contrast{"contrast"};
+    Input<int> blackLevel{"blackLevel"};
+    Input<int> whiteLevel{"whiteLevel"};
+
+    // Indexed by 10-bit raw value (by raw value / 8 on HVX)
+    Output<Buffer<uint8_t>> curve_lut{"curve_lut", 1};
+    // (column, row) of the 3x4 matrix, as camera_pipe uses it
+    Output<Buffer<int16_t>> matrix_q8{"matrix_q8", 2};
+
+    void generate() {
+        curve_lut(x) = tone_curve(gamma, contrast, blackLevel, whiteLevel)(x);
+        matrix_q8(x, y) = color_matrix(matrix_3200, matrix_7000, color_temp)(x, y);
+
+        if (auto_schedule) {
+            matrix_3200.dim(0).set_bounds_estimate(0, 4);
+            matrix_3200.dim(1).set_bounds_estimate(0, 3);
+            matrix_7000.dim(0).set_bounds_estimate(0, 4);
+            matrix_7000.dim(1).set_bounds_estimate(0, 3);
+
+            curve_lut.estimate(x, 0, 1024);
+            matrix_q8.estimate(x, 0, 4).estimate(y, 0, 3);
+        }
+    }
+};
+
+// camera_pipe with the tone curve and color matrix passed in precomputed
+// by camera_pipe_luts, so an unchanged parameter set costs nothing per frame.
+class CameraPipePrebaked : public CameraPipeBase<CameraPipePrebaked> {
+public:
+    Input<Buffer<uint16_t>> input{"input", 2};
+    Input<Buffer<uint8_t>> curve_lut{"curve_lut", 1};
+    Input<Buffer<int16_t>> matrix_q8{"matrix_q8", 2};
+    Input<float> sharpen_strength{"sharpen_strength"};
+
+    Output<Buffer<uint8_t>> processed{"processed", 3};
+
+    void generate() {
+        // Same 16, 12 shift as camera_pipe.
+        Func shifted = shift(input);
+
+        processed(x, y, c) = process(shifted, matrix_q8, curve_lut, sharpen_strength)(x, y, c);
+
+        matrix_q8.dim(0).set_bounds(0, 4);
+        matrix_q8.dim(1).set_bounds(0, 3);
+
+        // Schedule
+        if (auto_schedule) {
+            input.dim(0).set_bounds_estimate(0, 2592);
+            input.dim(1).set_bounds_estimate(0, 1968);
+            curve_lut.dim(0).set_bounds_estimate(0, 1024);
+
+            processed
+                .estimate(c, 0, 3)
+                .estimate(x, 0, 2592)
+                .estimate(y, 0, 1968);
+        } else {
+            schedule_strips(processed, processed.width(), processed.height(), false);
+
+            denoised.prefetch(input, y, 2);
+        }
+    }
+};
+
+// camera_pipe fed directly with MIPI CSI-2 packed raw rows, so the capture
+// path doesn't need a separate unpacking pass and a full-frame uint16_t copy.
+// RAW10 packs 4 pixels into 5 bytes: the high 8 bits of each pixel, then a
+// byte holding the four pairs of low bits. RAW12 packs 2 pixels into 3 bytes
+// the same way. RAW12 is reduced to the 10-bit range the tone curve, black
+// level and white level are defined over.
+class CameraPipePacked : public CameraPipeBase<CameraPipePacked> {
+public:
+    GeneratorParam<int> bits_per_pixel{"bits_per_pixel", 10};
+
+    // Packed bytes; dimension 0 is in bytes, not pixels
+    Input<Buffer<uint8_t>> input{"input", 2};
+    Input<Buffer<float>> matrix_3200{"matrix_3200", 2};
+    Input<Buffer<float>> matrix_7000{"matrix_7000", 2};
+    Input<float> color_temp{"color_temp"};
+    Input<float> gamma{"gamma"};
+    Input<float> contrast{"contrast"};
+    Input<float> sharpen_strength{"sharpen_strength"};
+    Input<int> blackLevel{"blackLevel"};
+    Input<int> whiteLevel{"whiteLevel"};
+
+    Output<Buffer<uint8_t>> processed{"processed", 3};
+
+    void generate();
+};
+
+void CameraPipePacked::generate() {
+    user_assert(bits_per_pixel == 10 || bits_per_pixel == 12)
+        << "camera_pipe_packed supports bits_per_pixel of 10 or 12, not " << bits_per_pixel << "\n";
+    // Pixels per packed group
+    const int group_size = bits_per_pixel == 10 ? 4 : 2;
+    const int group_bytes = group_size + 1;
+    const int low_bits = bits_per_pixel - 8;
+
+    Expr group = x / group_size;
+    Expr i = x % group_size;
+    Expr high = cast<uint16_t>(input(group * group_bytes + i, y));
+    Expr low = cast<uint16_t>(input(group * group_bytes + group_size, y));
+    low = (low >> cast<uint16_t>(i * low_bits)) & cast<uint16_t>((1 << low_bits) - 1);
+
+    Func unpacked("unpacked");
+    unpacked(x, y) = ((high << cast<uint16_t>(low_bits)) | low) >> cast<uint16_t>(bits_per_pixel - 10);
+
+    // Same 16, 12 shift as camera_pipe.
+    Func shifted = shift(unpacked);
+
+    Func matrix = color_matrix(matrix_3200, matrix_7000, color_temp);
+
+    Func curve = tone_curve(gamma, contrast, blackLevel, whiteLevel);
+
+    processed(x, y, c) = process(shifted, matrix, curve, sharpen_strength)(x, y, c);
+
+    // Schedule
+    if (auto_schedule) {
+        input.dim(0).set_bounds_estimate(0, 2592 * group_bytes / group_size);
+        input.dim(1).set_bounds_estimate(0, 1968);
 
         matrix_3200.dim(0).set_bounds_estimate(0, 4);
         matrix_3200.dim(1).set_bounds_estimate(0, 3);
@@ -425,121 +1178,667 @@ void CameraPipe::generate() {
             .estimate(c, 0, 3)
             .estimate(x, 0, 2592)
             .estimate(y, 0, 1968);
+    } else {
+        schedule_strips(processed, processed.width(), processed.height(), false);
+
+        // Unpack a few rows at a time inside the strip loop, just ahead of
+        // the denoiser, instead of into a full-frame intermediate. Splitting
+        // x by the group size and unrolling the group makes the byte
+        // offsets and shifts constants, leaving vectors of whole groups.
+        int vec = vector_size();
+        unpacked.compute_at(processed, yi).store_at(processed, yo)
+            .prefetch(input, y, 2)
+            .fold_storage(y, raw_fold_rows)
+            .split(x, x, xi, group_size)
+            .unroll(xi)
+            .vectorize(x, vec);
+    }
+}
+
+// camera_pipe producing YUV 4:2:0 for a video encoder instead of RGB. The
+// sharpened RGB rows are converted and subsampled while they're still in
+// cache, rather than written out and converted in another pass. BT.601
+// limited range, with each chroma sample taken from the average of a 2x2
+// block of RGB.
+//
+// chroma is (x, y, c) with c = 0 for Cb and 1 for Cr. Its memory layout is
+// the one chroma_layout names: NV12 interleaves Cb and Cr, I420 keeps them
+// in separate planes.
+enum class ChromaLayout { NV12, I420 };
+
+class CameraPipeYuv : public CameraPipeBase<CameraPipeYuv> {
+public:
+    GeneratorParam<ChromaLayout> chroma_layout{"chroma_layout", ChromaLayout::NV12,
+                                               {{"nv12", ChromaLayout::NV12},
+                                                {"i420", ChromaLayout::I420}}};
+
+    Input<Buffer<uint16_t>> input{"input", 2};
+    Input<Buffer<float>> matrix_3200{"matrix_3200", 2};
+    Input<Buffer<float>> matrix_7000{"matrix_7000", 2};
+    Input<float> color_temp{"color_temp"};
+    Input<float> gamma{"gamma"};
+    Input<float> contrast{"contrast"};
+    Input<float> sharpen_strength{"sharpen_strength"};
+    Input<int> blackLevel{"blackLevel"};
+    Input<int> whiteLevel{"whiteLevel"};
+
+    Output<Buffer<uint8_t>> luma{"luma", 2};
+    // Half the width and height of luma
+    Output<Buffer<uint8_t>> chroma{"chroma", 3};
+
+    void generate();
+};
+
+void CameraPipeYuv::generate() {
+    // Same 16, 12 shift as camera_pipe.
+    Func shifted = shift(input);
+
+    Func matrix = color_matrix(matrix_3200, matrix_7000, color_temp);
 
+    Func curve = tone_curve(gamma, contrast, blackLevel, whiteLevel);
+
+    Func sharpened = process(shifted, matrix, curve, sharpen_strength);
+
+    Expr r = cast<int32_t>(sharpened(x, y, 0));
+    Expr g = cast<int32_t>(sharpened(x, y, 1));
+    Expr b = cast<int32_t>(sharpened(x, y, 2));
+    luma(x, y) = cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+
+    Func subsampled("subsampled");
+    subsampled(x, y, c) = cast<int32_t>((cast<uint16_t>(sharpened(2*x, 2*y, c)) +
+                                         sharpened(2*x + 1, 2*y, c) +
+                                         sharpened(2*x, 2*y + 1, c) +
+                                         sharpened(2*x + 1, 2*y + 1, c) + 2) / 4);
+    r = subsampled(x, y, 0);
+    g = subsampled(x, y, 1);
+    b = subsampled(x, y, 2);
+    Expr cb = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    Expr cr = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    chroma(x, y, c) = cast<uint8_t>(select(c == 0, cb, cr));
+
+    if (chroma_layout == ChromaLayout::NV12) {
+        chroma.dim(0).set_stride(2);
+        chroma.dim(2).set_stride(1);
     } else {
+        chroma.dim(0).set_stride(1);
+    }
+    chroma.dim(2).set_bounds(0, 2);
 
-        Expr out_width = processed.width();
-        Expr out_height = processed.height();
-        // In HVX 128, we need 2 threads to saturate HVX with work,
-        //and in HVX 64 we need 4 threads, and on other devices,
-        // we might need many threads.
-        Expr strip_size;
-        if (get_target().has_feature(Target::HVX_128)) {
-            strip_size = processed.dim(1).extent() / 2;
-        } else if (get_target().has_feature(Target::HVX_64)) {
-            strip_size = processed.dim(1).extent() / 4;
-        } else {
-            strip_size = 32;
+    // Schedule
+    if (auto_schedule) {
+        input.dim(0).set_bounds_estimate(0, 2592);
+        input.dim(1).set_bounds_estimate(0, 1968);
+
+        matrix_3200.dim(0).set_bounds_estimate(0, 4);
+        matrix_3200.dim(1).set_bounds_estimate(0, 3);
+        matrix_7000.dim(0).set_bounds_estimate(0, 4);
+        matrix_7000.dim(1).set_bounds_estimate(0, 3);
+
+        luma
+            .estimate(x, 0, 2592)
+            .estimate(y, 0, 1968);
+        chroma
+            .estimate(c, 0, 2)
+            .estimate(x, 0, 1296)
+            .estimate(y, 0, 984);
+    } else {
+        // luma owns the strips, as processed does in camera_pipe. Each
+        // iteration of its yi loop covers two luma rows, which is exactly
+        // one chroma row, so chroma is fused into that loop and both
+        // read the same two rows of sharpened.
+        Expr strip_size = strip_rows(luma.height());
+        int width = tile_columns();
+        TailStrategy tail = tiles_divide_output() ? TailStrategy::RoundUp : TailStrategy::ShiftInwards;
+
+        luma.compute_root()
+            .split(y, yi, yii, 2, TailStrategy::RoundUp)
+            .split(yi, yo, yi, strip_size / 2)
+            .vectorize(x, width, tail)
+            .parallel(yo);
+
+        chroma.compute_root()
+            .reorder(c, x, y)
+            .split(y, yo, yi, strip_size / 2)
+            .vectorize(x, width / 2, tail)
+            .unroll(c)
+            .parallel(yo)
+            .compute_with(luma, yi);
+
+        sharpened.compute_at(luma, yi)
+            .reorder(c, x, y)
+            .vectorize(x, width, TailStrategy::RoundUp)
+            .unroll(c);
+
+        schedule_stages(LoopLevel(luma, yi), LoopLevel(luma, yo));
+
+        denoised.prefetch(input, y, 2);
+
+        if (get_target().features_any_of({Target::HVX_64, Target::HVX_128})) {
+            luma.hexagon();
+            chroma.hexagon();
+        }
+
+        chroma.bound(c, 0, 2);
+        if (tiles_divide_output()) {
+            luma.bound(x, 0, (luma.width()/width)*width);
+            chroma.bound(x, 0, (luma.width()/width)*(width/2));
+        }
+        if (strips_divide_output()) {
+            luma.bound(y, 0, (luma.height()/strip_size)*strip_size);
+            chroma.bound(y, 0, (luma.height()/strip_size)*(strip_size/2));
+        }
+    }
+}
+
+// camera_pipe over a burst of raw frames of the same scene, which are
+// aligned to the first and merged into one less noisy raw before
+// demosaicking, in the manner of HDR+.
+//
+// Alignment works on tiles, coarse to fine, over a pyramid of grayscale
+// frames made by averaging each 2x2 Bayer quad and then downsampling by 4
+// per level. Each level searches around the offset the level above found
+// for its tile, and the finest level gives an offset per 32x32 tile of raw
+// pixels, always a whole number of quads so the Bayer phase is kept.
+//
+// The merge is a per-tile weighted average of the aligned frames. A frame's
+// weight falls off linearly with its tile's mean absolute difference from
+// the reference, reaching zero at merge_threshold, so tiles that moved or
+// failed to align don't ghost.
+//
+// Frames are streamed a band of rows at a time: each call takes the same
+// window of rows from every frame and produces one band of processed, so
+// the driver only ever holds O(band x N) of the raw burst. The window runs
+// from first_row rows above the band's own raw to as far below it as the
+// driver has, enough for alignment to reach in from either side (see
+// burst_align_rows in process.cpp). Alignment tiles are laid out from the
+// top of the window, so the window should start on a multiple of 32 rows
+// to line the tiles of consecutive bands up.
+class CameraPipeBurst : public CameraPipeBase<CameraPipeBurst> {
+public:
+    // (x, y, frame), a window of rows of each frame. Frame 0 is the
+    // reference the others are aligned to.
+    Input<Buffer<uint16_t>> input{"input", 3};
+    // The window row at which the band's raw starts: processed row 0
+    // reads the same raw rows as camera_pipe's row 0 would of a raw
+    // starting here.
+    Input<int> first_row{"first_row", 0};
+    Input<Buffer<float>> matrix_3200{"matrix_3200", 2};
+    Input<Buffer<float>> matrix_7000{"matrix_7000", 2};
+    Input<float> color_temp{"color_temp"};
+    Input<float> gamma{"gamma"};
+    Input<float> contrast{"contrast"};
+    Input<float> sharpen_strength{"sharpen_strength"};
+    Input<int> blackLevel{"blackLevel"};
+    Input<int> whiteLevel{"whiteLevel"};
+    // In raw units of mean absolute difference per tile. The weights divide
+    // by it, so a call with zero or less fails its parameter check.
+    Input<float> merge_threshold{"merge_threshold", 24.0f, 1e-6f, 65535.0f};
+
+    Output<Buffer<uint8_t>> processed{"processed", 3};
+
+    void generate();
+
+private:
+    // Alignment tiles are tile_size pixels square at every pyramid level,
+    // and each level is level_factor times smaller than the one below.
+    static const int tile_size = 16;
+    static const int level_factor = 4;
+
+    Func downsample(Func f, const std::string &name);
+    Func align(Func layer, Func coarser, int radius, int max_offset, const std::string &name);
+
+    Var tx{"tx"}, ty{"ty"}, sx{"sx"}, sy{"sy"};
+};
+
+Func CameraPipeBurst::downsample(Func f, const std::string &name) {
+    RDom r(0, level_factor, 0, level_factor);
+    Func down(name);
+    down(x, y, n) = cast<uint16_t>(sum(cast<uint32_t>(f(x * level_factor + r.x, y * level_factor + r.y, n))) /
+                                   (level_factor * level_factor));
+    return down;
+}
+
+// Finds, for each tile of each frame, the offset within radius of the
+// coarser level's (scaled up) offset that minimizes the sum of absolute
+// differences from the reference. Returns (offset x, offset y, distance).
+// Offsets are clamped to max_offset, the furthest the levels above can
+// reach, so that bounds inference knows how far the search reads.
+Func CameraPipeBurst::align(Func layer, Func coarser, int radius, int max_offset, const std::string &name) {
+    Expr prev_x = 0, prev_y = 0;
+    if (coarser.defined()) {
+        prev_x = coarser(tx / level_factor, ty / level_factor, n)[0] * level_factor;
+        prev_y = coarser(tx / level_factor, ty / level_factor, n)[1] * level_factor;
+    }
+
+    RDom tile(0, tile_size, 0, tile_size);
+    Expr px = tx * tile_size + tile.x;
+    Expr py = ty * tile_size + tile.y;
+    Func dist(name + "_dist");
+    dist(tx, ty, sx, sy, n) = sum(cast<uint32_t>(absd(layer(px, py, 0),
+                                                      layer(px + prev_x + sx, py + prev_y + sy, n))));
+
+    RDom search(-radius, 2 * radius + 1, -radius, 2 * radius + 1);
+    Tuple best = argmin(dist(tx, ty, search.x, search.y, n));
+
+    Func alignment(name);
+    alignment(tx, ty, n) = Tuple(select(n == 0, 0, clamp(prev_x + best[0], -max_offset, max_offset)),
+                                 select(n == 0, 0, clamp(prev_y + best[1], -max_offset, max_offset)),
+                                 select(n == 0, cast<uint32_t>(0), best[2]));
+    return alignment;
+}
+
+void CameraPipeBurst::generate() {
+    // The search reads past the edges of the frame.
+    Func raw = BoundaryConditions::repeat_edge(input);
+
+    Func gray("gray");
+    gray(x, y, n) = cast<uint16_t>((cast<uint32_t>(raw(2*x, 2*y, n)) + raw(2*x+1, 2*y, n) +
+                                    raw(2*x, 2*y+1, n) + raw(2*x+1, 2*y+1, n)) / 4);
+    Func level1 = downsample(gray, "level1");
+    Func level2 = downsample(level1, "level2");
+
+    // Search radii of 4, 4 and 1 pixels at each level from the coarsest
+    // reach 4, 4*4 + 4 and 20*4 + 1 gray pixels in total.
+    Func align2 = align(level2, Func(), 4, 4, "align2");
+    Func align1 = align(level1, align2, 4, 20, "align1");
+    Func align0 = align(gray, align1, 1, 81, "align0");
+
+    Func weight("merge_weight");
+    Expr mean_dist = cast<float>(align0(tx, ty, n)[2]) / (tile_size * tile_size);
+    weight(tx, ty, n) = select(n == 0, 1.0f, max(0.0f, 1.0f - mean_dist / merge_threshold));
+
+    RDom frames(0, input.dim(2).extent());
+    Func total_weight("total_weight");
+    total_weight(tx, ty) = sum(weight(tx, ty, frames));
+
+    // Gray offsets are in quads, so they're doubled for raw pixels.
+    Expr tile_x = x / (2 * tile_size), tile_y = y / (2 * tile_size);
+    Expr offset_x = 2 * align0(tile_x, tile_y, frames)[0];
+    Expr offset_y = 2 * align0(tile_x, tile_y, frames)[1];
+    Func weighted_sum("weighted_sum");
+    weighted_sum(x, y) = 0.0f;
+    weighted_sum(x, y) += weight(tile_x, tile_y, frames) * raw(x + offset_x, y + offset_y, frames);
+
+    Func merged("merged");
+    merged(x, y) = cast<uint16_t>(clamp(weighted_sum(x, y) / total_weight(tile_x, tile_y) + 0.5f,
+                                        0.0f, 65535.0f));
+
+    // The band's raw, then the same 16, 12 shift as camera_pipe.
+    Func band("band");
+    band(x, y) = merged(x, y + first_row);
+    Func shifted = shift(band);
+
+    Func matrix = color_matrix(matrix_3200, matrix_7000, color_temp);
+
+    Func curve = tone_curve(gamma, contrast, blackLevel, whiteLevel);
+
+    processed(x, y, c) = process(shifted, matrix, curve, sharpen_strength)(x, y, c);
+
+    // Schedule
+    if (auto_schedule) {
+        input.dim(0).set_bounds_estimate(0, 2592);
+        input.dim(1).set_bounds_estimate(0, 664);
+        input.dim(2).set_bounds_estimate(0, 8);
+
+        matrix_3200.dim(0).set_bounds_estimate(0, 4);
+        matrix_3200.dim(1).set_bounds_estimate(0, 3);
+        matrix_7000.dim(0).set_bounds_estimate(0, 4);
+        matrix_7000.dim(1).set_bounds_estimate(0, 3);
+
+        processed
+            .estimate(c, 0, 3)
+            .estimate(x, 0, 2592)
+            .estimate(y, 0, 256);
+    } else {
+        schedule_strips(processed, processed.width(), processed.height(), false);
+
+        // Only the two coarse pyramid levels (1/64 of the window and
+        // smaller) and the per-tile alignments and weights are stored
+        // whole. The finest level is recomputed from the raw inside the
+        // search, and the merge happens a few rows at a time inside the
+        // strip loop, so nothing else grows with window size times burst
+        // length.
+        int vec = vector_size();
+        level1.compute_root()
+            .parallel(y)
+            .vectorize(x, vec);
+        level2.compute_root()
+            .vectorize(x, vec);
+
+        align2.compute_root();
+        align1.compute_root()
+            .parallel(ty);
+        align0.compute_root()
+            .parallel(ty);
+        weight.compute_root();
+        total_weight.compute_root();
+
+        merged.compute_at(processed, yi).store_at(processed, yo)
+            .fold_storage(y, raw_fold_rows)
+            .vectorize(x, vec);
+        weighted_sum.compute_at(merged, y)
+            .vectorize(x, vec);
+        weighted_sum.update()
+            .reorder(x, frames)
+            .vectorize(x, vec);
+    }
+}
+
+// camera_pipe that also produces a viewfinder preview, preview_factor times
+// smaller in each dimension, from the same strips. Each preview pixel is the
+// rounded mean of a preview_factor square block of processed. The strips of
+// the preview are fused with the strips of processed, so every full
+// resolution row is downsampled while it's still in cache.
+class CameraPipePreview : public CameraPipeBase<CameraPipePreview> {
+public:
+    GeneratorParam<int> preview_factor{"preview_factor", 4};
+
+    Input<Buffer<uint16_t>> input{"input", 2};
+    Input<Buffer<float>> matrix_3200{"matrix_3200", 2};
+    Input<Buffer<float>> matrix_7000{"matrix_7000", 2};
+    Input<float> color_temp{"color_temp"};
+    Input<float> gamma{"gamma"};
+    Input<float> contrast{"contrast"};
+    Input<float> sharpen_strength{"sharpen_strength"};
+    Input<int> blackLevel{"blackLevel"};
+    Input<int> whiteLevel{"whiteLevel"};
+
+    Output<Buffer<uint8_t>> processed{"processed", 3};
+    // processed's width and height divided by preview_factor
+    Output<Buffer<uint8_t>> preview{"preview", 3};
+
+    void generate();
+};
+
+void CameraPipePreview::generate() {
+    const int factor = preview_factor;
+    user_assert(factor == 4 || factor == 8)
+        << "camera_pipe_preview supports preview_factor of 4 or 8, not " << factor << "\n";
+
+    // Same 16, 12 shift as camera_pipe.
+    Func shifted = shift(input);
+
+    Func matrix = color_matrix(matrix_3200, matrix_7000, color_temp);
+
+    Func curve = tone_curve(gamma, contrast, blackLevel, whiteLevel);
+
+    Func sharpened = process(shifted, matrix, curve, sharpen_strength);
+
+    processed(x, y, c) = sharpened(x, y, c);
+
+    Expr block_sum = cast<uint32_t>(0);
+    for (int j = 0; j < factor; j++) {
+        for (int i = 0; i < factor; i++) {
+            block_sum += cast<uint32_t>(sharpened(x * factor + i, y * factor + j, c));
+        }
+    }
+    preview(x, y, c) = cast<uint8_t>((block_sum + factor * factor / 2) / (factor * factor));
+
+    // Schedule
+    if (auto_schedule) {
+        input.dim(0).set_bounds_estimate(0, 2592);
+        input.dim(1).set_bounds_estimate(0, 1968);
+
+        matrix_3200.dim(0).set_bounds_estimate(0, 4);
+        matrix_3200.dim(1).set_bounds_estimate(0, 3);
+        matrix_7000.dim(0).set_bounds_estimate(0, 4);
+        matrix_7000.dim(1).set_bounds_estimate(0, 3);
+
+        processed
+            .estimate(c, 0, 3)
+            .estimate(x, 0, 2592)
+            .estimate(y, 0, 1968);
+        preview
+            .estimate(c, 0, 3)
+            .estimate(x, 0, 2592 / factor)
+            .estimate(y, 0, 1968 / factor);
+    } else {
+        // sharpened is computed a strip at a time, two rows per iteration
+        // like processed in camera_pipe, and both outputs are copied and
+        // downsampled from it within the same iteration of the strip loop.
+        // Strips must hold a whole number of preview rows.
+        Expr strip_size = max(factor, (strip_rows(processed.height()) / factor) * factor);
+        int vec = vector_size();
+        int width = tile_columns();
+        TailStrategy tail = tiles_divide_output() ? TailStrategy::RoundUp : TailStrategy::ShiftInwards;
+
+        processed.compute_root()
+            .reorder(c, x, y)
+            .split(y, yo, yi, strip_size)
+            .vectorize(x, width, tail)
+            .unroll(c)
+            .parallel(yo);
+
+        preview.compute_root()
+            .reorder(c, x, y)
+            .split(y, yo, yi, strip_size / factor)
+            .vectorize(x, vec)
+            .unroll(c)
+            .parallel(yo)
+            .compute_with(processed, yo);
+
+        sharpened.compute_at(processed, yo)
+            .reorder(c, x, y)
+            .split(y, yi, yii, 2, TailStrategy::RoundUp)
+            .vectorize(x, width, TailStrategy::RoundUp)
+            .unroll(c);
+
+        schedule_stages(LoopLevel(sharpened, yi), LoopLevel(processed, yo));
+
+        denoised.prefetch(input, y, 2);
+
+        if (get_target().features_any_of({Target::HVX_64, Target::HVX_128})) {
+            processed.hexagon();
+            preview.hexagon();
         }
-        strip_size = (strip_size / 2) * 2;
 
-        int vec = get_target().natural_vector_size(UInt(16));
-        if (get_target().has_feature(Target::HVX_64)) {
-            vec = 32;
-        } else if (get_target().has_feature(Target::HVX_128)) {
-            vec = 64;
+        processed.bound(c, 0, 3);
+        preview.bound(c, 0, 3);
+        if (tiles_divide_output()) {
+            processed.bound(x, 0, (processed.width()/width)*width);
+        }
+        if (strips_divide_output()) {
+            processed.bound(y, 0, (processed.height()/strip_size)*strip_size);
+            preview.bound(y, 0, (processed.height()/strip_size)*(strip_size/factor));
         }
+    }
+}
+
+// camera_pipe plus the statistics auto-exposure and auto-white-balance need:
+// a histogram of each raw Bayer channel, and the mean of the color corrected
+// linear RGB over a grid of zones. They're accumulated per strip as part of
+// the strip loop, from stages it has just computed, and the per-strip
+// partials summed at the end, instead of in a separate scan of the frame.
+class CameraPipeStats : public CameraPipeBase<CameraPipeStats> {
+public:
+    GeneratorParam<int> zones_x{"zones_x", 16};
+    GeneratorParam<int> zones_y{"zones_y", 12};
+
+    Input<Buffer<uint16_t>> input{"input", 2};
+    Input<Buffer<float>> matrix_3200{"matrix_3200", 2};
+    Input<Buffer<float>> matrix_7000{"matrix_7000", 2};
+    Input<float> color_temp{"color_temp"};
+    Input<float> gamma{"gamma"};
+    Input<float> contrast{"contrast"};
+    Input<float> sharpen_strength{"sharpen_strength"};
+    Input<int> blackLevel{"blackLevel"};
+    Input<int> whiteLevel{"whiteLevel"};
+
+    Output<Buffer<uint8_t>> processed{"processed", 3};
+    // Pixel counts of the deinterleaved raw in 256 bins of raw >> 2, indexed
+    // by (bin, channel), with channels gr, r, b, gb.
+    Output<Buffer<uint32_t>> histogram{"histogram", 2};
+    // Mean color corrected (linear, pre tone curve) RGB of each zone of
+    // processed, indexed by (zone x, zone y, channel).
+    Output<Buffer<float>> zone_means{"zone_means", 3};
+
+    void generate();
+
+private:
+    static const int histogram_bins = 256;
+};
+
+void CameraPipeStats::generate() {
+    Var bin("bin"), zx("zx"), zy("zy"), s("s");
+    const int nzx = zones_x, nzy = zones_y;
+
+    // Same 16, 12 shift as camera_pipe.
+    Func shifted = shift(input);
+
+    Func matrix = color_matrix(matrix_3200, matrix_7000, color_temp);
+
+    Func curve = tone_curve(gamma, contrast, blackLevel, whiteLevel);
+
+    Func sharpened = process(shifted, matrix, curve, sharpen_strength);
+
+    processed(x, y, c) = sharpened(x, y, c);
+
+    Expr out_width = processed.width(), out_height = processed.height();
+    Expr strip_size = strip_rows(out_height);
+    Expr num_strips = (out_height + strip_size - 1) / strip_size;
+
+    // Strip s covers rows [s * strip_size, (s + 1) * strip_size) of processed
+    // and corrected, and half that of deinterleaved.
+    Func histogram_partial("histogram_partial");
+    histogram_partial(bin, c, s) = cast<uint32_t>(0);
+    RDom rh(0, out_width / 2, 0, strip_size / 2);
+    Expr raw_row = s * (strip_size / 2) + rh.y;
+    rh.where(raw_row < out_height / 2);
+    Expr raw = deinterleaved(rh.x, raw_row, c);
+    histogram_partial(clamp(cast<int32_t>(raw) >> 2, 0, histogram_bins - 1), c, s) += cast<uint32_t>(1);
+
+    // A strip holds at most strip_size rows of a zone, so its sums fit in
+    // 32 bits.
+    Func zone_partial("zone_partial");
+    zone_partial(zx, zy, c, s) = 0;
+    RDom rz(0, out_width, 0, strip_size);
+    Expr row = s * strip_size + rz.y;
+    rz.where(row < out_height);
+    zone_partial(rz.x * nzx / out_width, row * nzy / out_height, c, s) +=
+        cast<int32_t>(corrected(rz.x, row, c));
+
+    RDom rs(0, num_strips);
+    histogram(bin, c) = sum(histogram_partial(bin, c, rs));
+
+    // Zone zx spans columns [ceil(zx * w / zones_x), ceil((zx + 1) * w / zones_x)),
+    // matching the zone index computed above, and likewise for rows.
+    auto zone_start = [](Expr z, Expr extent, int zones) {
+        return (z * extent + zones - 1) / zones;
+    };
+    Expr zone_area = (zone_start(zx + 1, out_width, nzx) - zone_start(zx, out_width, nzx)) *
+                     (zone_start(zy + 1, out_height, nzy) - zone_start(zy, out_height, nzy));
+    zone_means(zx, zy, c) = sum(cast<float>(zone_partial(zx, zy, c, rs))) / cast<float>(zone_area);
+
+    // Schedule
+    if (auto_schedule) {
+        input.dim(0).set_bounds_estimate(0, 2592);
+        input.dim(1).set_bounds_estimate(0, 1968);
+
+        matrix_3200.dim(0).set_bounds_estimate(0, 4);
+        matrix_3200.dim(1).set_bounds_estimate(0, 3);
+        matrix_7000.dim(0).set_bounds_estimate(0, 4);
+        matrix_7000.dim(1).set_bounds_estimate(0, 3);
+
+        processed
+            .estimate(c, 0, 3)
+            .estimate(x, 0, 2592)
+            .estimate(y, 0, 1968);
+        histogram
+            .estimate(bin, 0, histogram_bins)
+            .estimate(c, 0, 4);
+        zone_means
+            .estimate(zx, 0, nzx)
+            .estimate(zy, 0, nzy)
+            .estimate(c, 0, 3);
+    } else {
+        // processed's strip loop is the same as camera_pipe's, and the
+        // partials for strip s are accumulated in the same iteration of it,
+        // right after processed. That needs deinterleaved and corrected for
+        // the whole strip, so unlike camera_pipe they are stored unfolded per
+        // strip (a few hundred KB at the default strip size), and the stages
+        // before each are slid along its rows instead of processed's.
+        int vec = vector_size();
+        int width = tile_columns();
+        TailStrategy tail = tiles_divide_output() ? TailStrategy::RoundUp : TailStrategy::ShiftInwards;
+        LoopLevel strip(processed, yo);
+
         processed.compute_root()
             .reorder(c, x, y)
             .split(y, yi, yii, 2, TailStrategy::RoundUp)
             .split(yi, yo, yi, strip_size / 2)
-            .vectorize(x, 2*vec, TailStrategy::RoundUp)
+            .vectorize(x, width, tail)
             .unroll(c)
             .parallel(yo);
 
-        denoised.compute_at(processed, yi).store_at(processed, yo)
-            .prefetch(input, y, 2)
-            .fold_storage(y, 16)
-            .tile(x, y, x, y, xi, yi, 2*vec, 2)
+        deinterleaved.compute_at(strip)
+            .reorder(c, x, y)
+            .vectorize(x, width, TailStrategy::RoundUp)
+            .unroll(c);
+        denoised.compute_at(deinterleaved, y).store_at(strip)
+            .fold_storage(y, denoised_fold_rows)
+            .tile(x, y, x, y, xi, yi, width, 2)
             .vectorize(xi)
             .unroll(yi);
 
-        deinterleaved.compute_at(processed, yi).store_at(processed, yo)
-            .fold_storage(y, 8)
+        corrected.compute_at(strip)
             .reorder(c, x, y)
-            .vectorize(x, 2*vec, TailStrategy::RoundUp)
+            .tile(x, y, x, y, xi, yi, width, 2, TailStrategy::RoundUp)
+            .vectorize(xi)
+            .unroll(yi)
             .unroll(c);
+        demosaiced->intermed_compute_at.set({corrected, y});
+        demosaiced->intermed_store_at.set(strip);
+        demosaiced->output_compute_at.set({corrected, x});
 
-        curved.compute_at(processed, yi).store_at(processed, yo)
+        curved.compute_at(processed, yi).store_at(strip)
+            .fold_storage(y, curved_fold_rows)
             .reorder(c, x, y)
-            .tile(x, y, x, y, xi, yi, 2*vec, 2, TailStrategy::RoundUp)
+            .tile(x, y, x, y, xi, yi, width, 2, TailStrategy::RoundUp)
             .vectorize(xi)
             .unroll(yi)
             .unroll(c);
-        corrected.compute_at(curved, x)
-            .reorder(c, x, y)
-            .vectorize(x)
-            .unroll(c);
 
-        demosaiced->intermed_compute_at.set({processed, yi});
-        demosaiced->intermed_store_at.set({processed, yo});
-        demosaiced->output_compute_at.set({curved, x});
+        // Each strip only updates its own partials, so the strip loop stays
+        // parallel.
+        histogram_partial.compute_root()
+            .vectorize(bin, vec);
+        histogram_partial.update()
+            .reorder(c, rh.x, rh.y, s)
+            .unroll(c)
+            .parallel(s)
+            .compute_with(strip);
 
-        if (get_target().features_any_of({Target::HVX_64, Target::HVX_128})) {
-            processed.hexagon();
-            denoised.align_storage(x, vec);
-            deinterleaved.align_storage(x, vec);
-            corrected.align_storage(x, vec);
+        zone_partial.compute_root();
+        zone_partial.update()
+            .reorder(c, rz.x, rz.y, s)
+            .unroll(c)
+            .parallel(s)
+            .compute_with(strip);
+
+        histogram.compute_root()
+            .vectorize(bin, vec);
+        zone_means.compute_root();
+
+        processed.bound(c, 0, 3);
+        histogram.bound(bin, 0, histogram_bins).bound(c, 0, 4);
+        zone_means.bound(zx, 0, nzx).bound(zy, 0, nzy).bound(c, 0, 3);
+        if (tiles_divide_output()) {
+            processed.bound(x, 0, (out_width/width)*width);
         }
-
-        // We can generate slightly better code if we know the splits divide the extent.
-        processed
-            .bound(c, 0, 3)
-            .bound(x, 0, ((out_width)/(2*vec))*(2*vec))
-            .bound(y, 0, (out_height/strip_size)*strip_size);
-
-        /* Optional tags to specify layout for HalideTraceViz */
-        {
-            Halide::Trace::FuncConfig cfg;
-            cfg.max = 1024;
-            cfg.pos = { 10, 348 };
-            cfg.labels = {{"input"}};
-            input.add_trace_tag(cfg.to_trace_tag());
-
-            cfg.pos = { 305, 360 };
-            cfg.labels = {{"denoised"}};
-            denoised.add_trace_tag(cfg.to_trace_tag());
-
-            cfg.pos = { 580, 120 };
-            const int y_offset = 220;
-            cfg.strides = {{1, 0}, {0, 1}, {0, y_offset}};
-            cfg.labels = {
-                { "gr", { 0, 0 * y_offset } },
-                { "r",  { 0, 1 * y_offset }},
-                { "b",  { 0, 2 * y_offset }},
-                { "gb", { 0, 3 * y_offset }},
-            };
-            deinterleaved.add_trace_tag(cfg.to_trace_tag());
-
-            cfg.color_dim = 2;
-            cfg.strides = {{1, 0}, {0, 1}, {0, 0}};
-            cfg.pos = { 1140, 360 };
-            cfg.labels = {{"demosaiced"}};
-            processed.add_trace_tag(cfg.to_trace_tag());
-
-            cfg.pos = { 1400, 360 };
-            cfg.labels = {{"color-corrected"}};
-            corrected.add_trace_tag(cfg.to_trace_tag());
-
-            cfg.max = 256;
-            cfg.pos = { 1660, 360 };
-            cfg.labels = {{"gamma-corrected"}};
-            curved.add_trace_tag(cfg.to_trace_tag());
-
+        if (strips_divide_output()) {
+            processed.bound(y, 0, (out_height/strip_size)*strip_size);
         }
     }
-};
+}
 
 }  // namespace
 
 HALIDE_REGISTER_GENERATOR(CameraPipe, camera_pipe)
+HALIDE_REGISTER_GENERATOR(CameraPipeBatch, camera_pipe_batch)
+HALIDE_REGISTER_GENERATOR(CameraPipeLuts, camera_pipe_luts)
+HALIDE_REGISTER_GENERATOR(CameraPipePrebaked, camera_pipe_prebaked)
+HALIDE_REGISTER_GENERATOR(CameraPipePacked, camera_pipe_packed)
+HALIDE_REGISTER_GENERATOR(CameraPipeYuv, camera_pipe_yuv)
+HALIDE_REGISTER_GENERATOR(CameraPipeBurst, camera_pipe_burst)
+HALIDE_REGISTER_GENERATOR(CameraPipePreview, camera_pipe_preview)
+HALIDE_REGISTER_GENERATOR(CameraPipeStats, camera_pipe_stats)
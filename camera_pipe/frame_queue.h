@@ -0,0 +1,60 @@
+#ifndef CAMERA_PIPE_FRAME_QUEUE_H
+#define CAMERA_PIPE_FRAME_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+/**
+ * Bounded blocking FIFO used to hand frames between the stages of the
+ * streaming driver. push() blocks while the queue is full, which is what
+ * keeps a fast decoder from running arbitrarily far ahead of the pipeline.
+ *
+ * Once close() has been called, push() fails and pop() drains whatever is
+ * left before failing too, so every stage can shut down in order.
+ */
+template<typename T>
+class FrameQueue {
+public:
+    explicit FrameQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [&]() { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [&]() { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    const size_t capacity;
+    bool closed = false;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_full, not_empty;
+};
+
+#endif  // CAMERA_PIPE_FRAME_QUEUE_H
@@ -0,0 +1,210 @@
+#ifndef CAMERA_PIPE_JPEG_STRIP_ENCODER_H
+#define CAMERA_PIPE_JPEG_STRIP_ENCODER_H
+
+#include "HalideBuffer.h"
+
+#include <cstdint>
+#include <cstdio>
+// jpeglib.h needs size_t and FILE declared first
+#include <jpeglib.h>
+#include <setjmp.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * Encodes a frame as one baseline JPEG a band of rows at a time, with the
+ * bands encoded independently (and so in parallel, and as soon as each is
+ * ready) and joined at the end.
+ *
+ * This works because of restart markers. At a restart the encoder resets
+ * its DC predictions and byte-aligns, which is exactly the state a fresh
+ * encoder starts in. So a JPEG whose restart interval is one band's worth
+ * of MCUs is the entropy-coded data of each band encoded as its own image,
+ * with RSTn markers between them. Every band uses libjpeg's default (not
+ * optimized) Huffman tables and the same quality, so the first band's
+ * headers serve for the whole frame once its height is patched and a DRI
+ * marker added.
+ *
+ * Bands must be a multiple of 16 rows, the height of an MCU with the
+ * default 2x2 chroma subsampling, except for the last.
+ */
+class JpegStripEncoder {
+public:
+    JpegStripEncoder(int width, int height, int band_rows, int quality = 90)
+        : width(width), height(height), band_rows(band_rows), quality(quality),
+          bands((height + band_rows - 1) / band_rows) {}
+
+    int num_bands() const {
+        return (int)bands.size();
+    }
+
+    // Encodes band index from a planar (x, y, c) buffer of its rows.
+    // Distinct bands may be encoded concurrently.
+    bool encode_band(const Halide::Runtime::Buffer<uint8_t> &band, int index) {
+        return encode(band, bands[index]);
+    }
+
+    // Joins the encoded bands into a JPEG file.
+    bool write(const std::string &path) {
+        std::vector<uint8_t> jpeg;
+        if (!join(jpeg)) {
+            return false;
+        }
+        FILE *f = fopen(path.c_str(), "wb");
+        if (!f) {
+            fprintf(stderr, "Could not open %s\n", path.c_str());
+            return false;
+        }
+        bool ok = fwrite(jpeg.data(), 1, jpeg.size(), f) == jpeg.size();
+        return fclose(f) == 0 && ok;
+    }
+
+private:
+    struct ErrorManager {
+        jpeg_error_mgr mgr;
+        jmp_buf jump;
+    };
+
+    static void error_exit(j_common_ptr cinfo) {
+        (*cinfo->err->output_message)(cinfo);
+        longjmp(((ErrorManager *)cinfo->err)->jump, 1);
+    }
+
+    // A libjpeg destination appending to a std::vector, which every
+    // libjpeg version can use (jpeg_mem_dest is a libjpeg 8 addition).
+    struct Destination {
+        jpeg_destination_mgr mgr;
+        std::vector<uint8_t> *out;
+        uint8_t chunk[16384];
+    };
+
+    static void init_destination(j_compress_ptr cinfo) {
+        Destination *d = (Destination *)cinfo->dest;
+        d->mgr.next_output_byte = d->chunk;
+        d->mgr.free_in_buffer = sizeof(d->chunk);
+    }
+
+    static boolean empty_output_buffer(j_compress_ptr cinfo) {
+        Destination *d = (Destination *)cinfo->dest;
+        d->out->insert(d->out->end(), d->chunk, d->chunk + sizeof(d->chunk));
+        init_destination(cinfo);
+        return TRUE;
+    }
+
+    static void term_destination(j_compress_ptr cinfo) {
+        Destination *d = (Destination *)cinfo->dest;
+        d->out->insert(d->out->end(), d->chunk, d->chunk + sizeof(d->chunk) - d->mgr.free_in_buffer);
+    }
+
+    bool encode(const Halide::Runtime::Buffer<uint8_t> &band, std::vector<uint8_t> &out) {
+        jpeg_compress_struct cinfo;
+        ErrorManager err;
+        Destination dest;
+        std::vector<JSAMPLE> row(band.width() * 3);
+        out.clear();
+
+        cinfo.err = jpeg_std_error(&err.mgr);
+        err.mgr.error_exit = error_exit;
+        if (setjmp(err.jump)) {
+            jpeg_destroy_compress(&cinfo);
+            return false;
+        }
+        jpeg_create_compress(&cinfo);
+        dest.mgr.init_destination = init_destination;
+        dest.mgr.empty_output_buffer = empty_output_buffer;
+        dest.mgr.term_destination = term_destination;
+        dest.out = &out;
+        cinfo.dest = &dest.mgr;
+
+        cinfo.image_width = band.width();
+        cinfo.image_height = band.height();
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, quality, TRUE);
+        jpeg_start_compress(&cinfo, TRUE);
+        for (int y = band.dim(1).min(); y <= band.dim(1).max(); y++) {
+            for (int x = 0; x < band.width(); x++) {
+                for (int c = 0; c < 3; c++) {
+                    row[x * 3 + c] = band(band.dim(0).min() + x, y, c);
+                }
+            }
+            JSAMPROW rows[] = {row.data()};
+            jpeg_write_scanlines(&cinfo, rows, 1);
+        }
+        jpeg_finish_compress(&cinfo);
+        jpeg_destroy_compress(&cinfo);
+        return true;
+    }
+
+    // Offset of the first marker of the given type in jpeg's headers, or
+    // -1. Stops at the start of scan, after which markers can't be found by
+    // walking segment lengths.
+    static int find_marker(const std::vector<uint8_t> &jpeg, uint8_t marker) {
+        size_t i = 2;  // after SOI
+        while (i + 4 <= jpeg.size() && jpeg[i] == 0xFF) {
+            if (jpeg[i + 1] == marker) {
+                return (int)i;
+            }
+            if (jpeg[i + 1] == 0xDA) {
+                return -1;
+            }
+            i += 2 + ((jpeg[i + 2] << 8) | jpeg[i + 3]);
+        }
+        return -1;
+    }
+
+    bool join(std::vector<uint8_t> &jpeg) {
+        for (const auto &b : bands) {
+            if (b.empty()) {
+                fprintf(stderr, "Not every band has been encoded\n");
+                return false;
+            }
+        }
+
+        const std::vector<uint8_t> &first = bands[0];
+        int sof = find_marker(first, 0xC0);
+        int sos = find_marker(first, 0xDA);
+        if (sof < 0 || sos < 0) {
+            fprintf(stderr, "Unexpected JPEG layout from libjpeg\n");
+            return false;
+        }
+
+        // Headers up to the start of scan, with the frame's height.
+        jpeg.assign(first.begin(), first.begin() + sos);
+        jpeg[sof + 5] = height >> 8;
+        jpeg[sof + 6] = height & 0xFF;
+
+        // Restart every band: its MCU rows times the MCUs per row.
+        if (bands.size() > 1) {
+            int interval = (band_rows / 16) * ((width + 15) / 16);
+            const uint8_t dri[] = {0xFF, 0xDD, 0x00, 0x04, (uint8_t)(interval >> 8), (uint8_t)(interval & 0xFF)};
+            jpeg.insert(jpeg.end(), dri, dri + sizeof(dri));
+        }
+
+        for (size_t i = 0; i < bands.size(); i++) {
+            const std::vector<uint8_t> &b = bands[i];
+            int band_sos = find_marker(b, 0xDA);
+            if (band_sos < 0) {
+                return false;
+            }
+            size_t scan_start = band_sos + 2 + ((b[band_sos + 2] << 8) | b[band_sos + 3]);
+            // The first band keeps its SOS segment; the data runs up to EOI.
+            size_t from = i == 0 ? band_sos : scan_start;
+            jpeg.insert(jpeg.end(), b.begin() + from, b.end() - 2);
+            if (i + 1 < bands.size()) {
+                jpeg.push_back(0xFF);
+                jpeg.push_back(0xD0 + i % 8);
+            }
+        }
+        jpeg.push_back(0xFF);
+        jpeg.push_back(0xD9);
+        return true;
+    }
+
+    int width, height, band_rows, quality;
+    std::vector<std::vector<uint8_t>> bands;
+};
+
+#endif  // CAMERA_PIPE_JPEG_STRIP_ENCODER_H
@@ -0,0 +1,70 @@
+#ifndef CAMERA_PIPE_LUT_CACHE_H
+#define CAMERA_PIPE_LUT_CACHE_H
+
+#include "camera_pipe_luts.h"
+
+#include "HalideBuffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <tuple>
+
+/**
+ * Keeps the tone curve LUT and Q8.8 color matrix built by camera_pipe_luts,
+ * keyed by the parameters they depend on, so consecutive frames with the same
+ * gamma, contrast, levels and color temperature skip rebuilding them.
+ *
+ * The calibration matrices are fixed for the lifetime of a cache. Keys
+ * compare exactly; these parameters come from the capture settings rather
+ * than being estimated per frame, so there's no need to quantize them.
+ */
+class LutCache {
+public:
+    struct Entry {
+        Halide::Runtime::Buffer<uint8_t> curve_lut;
+        Halide::Runtime::Buffer<int16_t> matrix_q8;
+    };
+
+    LutCache(Halide::Runtime::Buffer<float> matrix_3200,
+             Halide::Runtime::Buffer<float> matrix_7000,
+             size_t max_entries = 16)
+        : matrix_3200(matrix_3200), matrix_7000(matrix_7000), max_entries(max_entries) {}
+
+    // Returns the tables for this parameter set, running camera_pipe_luts
+    // only if they aren't cached yet. Returns nullptr if that fails.
+    Entry *lookup(float color_temp, float gamma, float contrast, int blackLevel, int whiteLevel) {
+        Key key(color_temp, gamma, contrast, blackLevel, whiteLevel);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            hits++;
+            return &it->second;
+        }
+
+        misses++;
+        Entry e;
+        e.curve_lut = Halide::Runtime::Buffer<uint8_t>(1024);
+        e.matrix_q8 = Halide::Runtime::Buffer<int16_t>(4, 3);
+        if (camera_pipe_luts(matrix_3200, matrix_7000, color_temp, gamma, contrast,
+                             blackLevel, whiteLevel, e.curve_lut, e.matrix_q8) != 0) {
+            return nullptr;
+        }
+        if (entries.size() >= max_entries) {
+            // Parameter changes are rare enough that anything cleverer than
+            // starting over isn't worth it.
+            entries.clear();
+        }
+        return &(entries[key] = e);
+    }
+
+    size_t hits = 0, misses = 0;
+
+private:
+    typedef std::tuple<float, float, float, int, int> Key;
+
+    Halide::Runtime::Buffer<float> matrix_3200, matrix_7000;
+    size_t max_entries;
+    std::map<Key, Entry> entries;
+};
+
+#endif  // CAMERA_PIPE_LUT_CACHE_H
@@ -0,0 +1,134 @@
+#ifndef CAMERA_PIPE_MEMORY_TRACE_H
+#define CAMERA_PIPE_MEMORY_TRACE_H
+
+#include "HalideRuntime.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * Accounting on top of halide_malloc_trace.h. install() wraps whatever
+ * custom malloc and free hooks are in place, normally the ones
+ * halide_enable_malloc_trace() installs, and keeps the live heap bytes of
+ * the whole process and of each thread, and the high-water mark of each,
+ * before passing every call on to them. Halide allocates per-strip scratch
+ * on the worker thread running the strip, so a thread's high-water mark is
+ * the scratch one strip needs.
+ *
+ * The hooks are process-wide, so there is a single trace.
+ */
+class MemoryTrace {
+public:
+    struct Usage {
+        size_t allocs = 0;
+        size_t live_bytes = 0, peak_bytes = 0;
+        // The largest single allocation
+        size_t largest = 0;
+    };
+
+    static MemoryTrace &instance() {
+        static MemoryTrace trace;
+        return trace;
+    }
+
+    void install() {
+        previous_malloc = halide_set_custom_malloc(halide_malloc_hook);
+        previous_free = halide_set_custom_free(halide_free_hook);
+    }
+
+    void uninstall() {
+        halide_set_custom_malloc(previous_malloc);
+        halide_set_custom_free(previous_free);
+    }
+
+    // Clears the counts and high-water marks, keeping only what is live.
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        reset(total);
+        for (auto &t : threads) {
+            reset(t.second);
+        }
+    }
+
+    Usage get_total() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total;
+    }
+
+    std::map<std::thread::id, Usage> get_threads() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return threads;
+    }
+
+private:
+    // What each live allocation was, so frees (possibly on another thread)
+    // are charged back to the thread that allocated.
+    struct Allocation {
+        size_t size;
+        std::thread::id thread;
+    };
+
+    static void reset(Usage &u) {
+        u.allocs = 0;
+        u.peak_bytes = u.live_bytes;
+        u.largest = 0;
+    }
+
+    static void *halide_malloc_hook(void *user_context, size_t size) {
+        MemoryTrace &trace = instance();
+        void *ptr = trace.previous_malloc(user_context, size);
+        if (ptr) {
+            trace.record(ptr, size, true);
+        }
+        return ptr;
+    }
+
+    static void halide_free_hook(void *user_context, void *ptr) {
+        MemoryTrace &trace = instance();
+        if (ptr) {
+            trace.record(ptr, 0, false);
+        }
+        trace.previous_free(user_context, ptr);
+    }
+
+    void record(void *ptr, size_t size, bool allocated) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Allocation a = {size, std::this_thread::get_id()};
+        if (allocated) {
+            live[ptr] = a;
+        } else {
+            auto it = live.find(ptr);
+            if (it == live.end()) {
+                // Allocated before install()
+                return;
+            }
+            a = it->second;
+            live.erase(it);
+        }
+        for (Usage *u : {&total, &threads[a.thread]}) {
+            if (allocated) {
+                u->allocs++;
+                u->live_bytes += a.size;
+                u->peak_bytes = std::max(u->peak_bytes, u->live_bytes);
+                u->largest = std::max(u->largest, a.size);
+            } else {
+                u->live_bytes -= a.size;
+            }
+        }
+    }
+
+    MemoryTrace() {}
+
+    std::mutex mutex;
+    Usage total;
+    std::map<std::thread::id, Usage> threads;
+    std::unordered_map<void *, Allocation> live;
+    halide_malloc_t previous_malloc = nullptr;
+    halide_free_t previous_free = nullptr;
+};
+
+#endif  // CAMERA_PIPE_MEMORY_TRACE_H
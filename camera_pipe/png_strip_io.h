@@ -0,0 +1,162 @@
+#ifndef CAMERA_PIPE_PNG_STRIP_IO_H
+#define CAMERA_PIPE_PNG_STRIP_IO_H
+
+#include "HalideBuffer.h"
+
+#include <png.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Row-at-a-time PNG reading and writing for drivers that must not hold a
+ * whole frame in memory. halide_image_io.h always decodes or encodes the full
+ * image, which is what we're avoiding here.
+ */
+
+// Reads a grayscale raw PNG a band of rows at a time, converting to uint16
+// the same way load_and_convert_image does (8-bit v becomes v * 257).
+class PngRowReader {
+public:
+    ~PngRowReader() {
+        if (png) {
+            png_destroy_read_struct(&png, &info, nullptr);
+        }
+        if (f) {
+            fclose(f);
+        }
+    }
+
+    bool open(const std::string &path) {
+        f = fopen(path.c_str(), "rb");
+        if (!f) {
+            fprintf(stderr, "Could not open %s\n", path.c_str());
+            return false;
+        }
+        png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        info = png ? png_create_info_struct(png) : nullptr;
+        if (!info || setjmp(png_jmpbuf(png))) {
+            fprintf(stderr, "Could not read PNG header of %s\n", path.c_str());
+            return false;
+        }
+        png_init_io(png, f);
+        png_read_info(png, info);
+
+        if (png_get_color_type(png, info) != PNG_COLOR_TYPE_GRAY ||
+            png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) {
+            fprintf(stderr, "%s is not a non-interlaced grayscale raw\n", path.c_str());
+            return false;
+        }
+        bit_depth = png_get_bit_depth(png, info);
+        if (bit_depth < 8) {
+            png_set_expand_gray_1_2_4_to_8(png);
+            bit_depth = 8;
+        }
+        // PNG stores 16-bit samples big-endian
+        if (bit_depth == 16) {
+            png_set_swap(png);
+        }
+        png_read_update_info(png, info);
+
+        width = png_get_image_width(png, info);
+        height = png_get_image_height(png, info);
+        row.resize(png_get_rowbytes(png, info));
+        return true;
+    }
+
+    // Reads the next `rows` rows into rows [dst_row, dst_row + rows) of dst.
+    bool read_rows(Halide::Runtime::Buffer<uint16_t> &dst, int dst_row, int rows) {
+        if (setjmp(png_jmpbuf(png))) {
+            return false;
+        }
+        for (int r = 0; r < rows; r++) {
+            png_read_row(png, row.data(), nullptr);
+            for (int x = 0; x < width; x++) {
+                uint16_t v;
+                if (bit_depth == 16) {
+                    v = ((const uint16_t *)row.data())[x];
+                } else {
+                    v = row[x];
+                    v = (v << 8) | v;
+                }
+                dst(x, dst_row + r) = v;
+            }
+        }
+        return true;
+    }
+
+    int width = 0, height = 0;
+
+private:
+    FILE *f = nullptr;
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+    int bit_depth = 0;
+    std::vector<png_byte> row;
+};
+
+// Writes an 8-bit RGB PNG from planar (x, y, c) bands of rows.
+class PngRowWriter {
+public:
+    ~PngRowWriter() {
+        if (png) {
+            png_destroy_write_struct(&png, &info);
+        }
+        if (f) {
+            fclose(f);
+        }
+    }
+
+    bool open(const std::string &path, int width, int height) {
+        f = fopen(path.c_str(), "wb");
+        if (!f) {
+            fprintf(stderr, "Could not open %s\n", path.c_str());
+            return false;
+        }
+        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        info = png ? png_create_info_struct(png) : nullptr;
+        if (!info || setjmp(png_jmpbuf(png))) {
+            fprintf(stderr, "Could not write PNG header of %s\n", path.c_str());
+            return false;
+        }
+        png_init_io(png, f);
+        png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB,
+                     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(png, info);
+        row.resize(width * 3);
+        return true;
+    }
+
+    bool write_rows(const Halide::Runtime::Buffer<uint8_t> &band) {
+        if (setjmp(png_jmpbuf(png))) {
+            return false;
+        }
+        for (int y = 0; y < band.height(); y++) {
+            for (int x = 0; x < band.width(); x++) {
+                for (int c = 0; c < 3; c++) {
+                    row[x * 3 + c] = band(x, y, c);
+                }
+            }
+            png_write_row(png, row.data());
+        }
+        return true;
+    }
+
+    bool finish() {
+        if (setjmp(png_jmpbuf(png))) {
+            return false;
+        }
+        png_write_end(png, nullptr);
+        return true;
+    }
+
+private:
+    FILE *f = nullptr;
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+    std::vector<png_byte> row;
+};
+
+#endif  // CAMERA_PIPE_PNG_STRIP_IO_H
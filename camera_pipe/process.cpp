@@ -1,6 +1,23 @@
 #include "halide_benchmark.h"
 
 #include "camera_pipe.h"
+#include "camera_pipe_batch.h"
+#include "camera_pipe_luts.h"
+#include "camera_pipe_prebaked.h"
+#include "camera_pipe_raw10.h"
+#include "camera_pipe_raw12.h"
+#include "camera_pipe_nv12.h"
+#include "camera_pipe_i420.h"
+#include "camera_pipe_malvar.h"
+#include "camera_pipe_ahd.h"
+#include "camera_pipe_burst.h"
+#include "camera_pipe_profiled.h"
+#include "camera_pipe_ahd_profiled.h"
+#include "camera_pipe_preview4.h"
+#include "camera_pipe_preview8.h"
+#include "camera_pipe_stats.h"
+#include "camera_pipe_cfa.h"
+#include "camera_pipe_fold.h"
 #ifndef NO_AUTO_SCHEDULE
 #include "camera_pipe_auto_schedule.h"
 #endif
@@ -9,18 +26,198 @@
 #include "halide_image_io.h"
 #include "halide_malloc_trace.h"
 
+#include "arena_allocator.h"
+#include "frame_queue.h"
+#include "jpeg_strip_encoder.h"
+#include "memory_trace.h"
+#include "lut_cache.h"
+#include "png_strip_io.h"
+#include "roi_region.h"
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
 using namespace Halide::Runtime;
 using namespace Halide::Tools;
 
-int main(int argc, char **argv) {
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds_between(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double>(end - start).count();
+}
+
+// Everything camera_pipe takes besides the raw frame itself.
+struct PipeParams {
+    Buffer<float> matrix_3200, matrix_7000;
+    float color_temp, gamma, contrast, sharpen;
+    int blackLevel = 25;
+    int whiteLevel = 1023;
+};
+
+// Parses "color_temp gamma contrast sharpen" starting at argv[0].
+PipeParams make_params(char **argv) {
+    PipeParams p;
+
+    // These color matrices are for the sensor in the Nokia N900 and are
+    // taken from the FCam source.
+    float _matrix_3200[][4] = {{ 1.6697f, -0.2693f, -0.4004f, -42.4346f},
+                                {-0.3576f,  1.0615f,  1.5949f, -37.1158f},
+                                {-0.2175f, -1.8751f,  6.9640f, -26.6970f}};
+
+    float _matrix_7000[][4] = {{ 2.2997f, -0.4478f,  0.1706f, -39.0923f},
+                                {-0.3826f,  1.5906f, -0.2080f, -25.4311f},
+                                {-0.0888f, -0.7344f,  2.2832f, -20.0826f}};
+    p.matrix_3200 = Buffer<float>(4, 3);
+    p.matrix_7000 = Buffer<float>(4, 3);
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            p.matrix_3200(j, i) = _matrix_3200[i][j];
+            p.matrix_7000(j, i) = _matrix_7000[i][j];
+        }
+    }
+
+    p.color_temp = (float) atof(argv[0]);
+    p.gamma = (float) atof(argv[1]);
+    p.contrast = (float) atof(argv[2]);
+    p.sharpen = (float) atof(argv[3]);
+    return p;
+}
+
+// The pipeline reads a 16x12 pixel border around the output, and the
+// manual schedule wants both output dimensions to be a multiple of 32.
+Buffer<uint8_t> make_output(const Buffer<uint16_t> &input) {
+    return Buffer<uint8_t>(((input.width() - 32)/32)*32, ((input.height() - 24)/32)*32, 3);
+}
+
+// Raw rows a band of output rows depends on beyond its own height: the 12
+// row shift at the top and bottom covers the denoise, demosaic and sharpen
+// stencils, which together reach at most 8 rows above and below. So output
+// rows [y, y + n) are exactly determined by raw rows [y, y + n + 24).
+const int raw_halo_rows = 24;
+
+int run_camera_pipe(Buffer<uint16_t> &input, PipeParams &p, Buffer<uint8_t> &output) {
+    return camera_pipe(input, p.matrix_3200, p.matrix_7000,
+                       p.color_temp, p.gamma, p.contrast, p.sharpen, p.blackLevel, p.whiteLevel,
+                       output);
+}
+
+// Latency samples for one stage of the streaming driver.
+struct StageStats {
+    std::vector<double> samples;
+
+    void report(const char *name) {
+        if (samples.empty()) {
+            return;
+        }
+        std::sort(samples.begin(), samples.end());
+        double total = 0;
+        for (double s : samples) {
+            total += s;
+        }
+        size_t n = samples.size();
+        fprintf(stderr, "  %-8s mean %8.2fms  p50 %8.2fms  p95 %8.2fms  max %8.2fms\n",
+                name,
+                total / n * 1e3,
+                samples[n / 2] * 1e3,
+                samples[std::min(n - 1, (n * 95) / 100)] * 1e3,
+                samples[n - 1] * 1e3);
+    }
+};
+
+// A frame in flight through the streaming driver.
+struct Frame {
+    std::string path;
+    Buffer<uint16_t> raw;
+    Buffer<uint8_t> processed;
+    Clock::time_point start;
+};
+
+bool is_directory(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool ends_with(const std::string &s, const std::string &suffix) {
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Either every .png in a directory (in name order, so sensor dumps stay in
+// capture order), or one path per line of a list file.
+std::vector<std::string> list_frames(const std::string &source) {
+    std::vector<std::string> frames;
+    if (is_directory(source)) {
+        DIR *dir = opendir(source.c_str());
+        if (!dir) {
+            return frames;
+        }
+        while (struct dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (ends_with(name, ".png")) {
+                frames.push_back(source + "/" + name);
+            }
+        }
+        closedir(dir);
+        std::sort(frames.begin(), frames.end());
+    } else {
+        std::ifstream list(source.c_str());
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty()) {
+                frames.push_back(line);
+            }
+        }
+    }
+    return frames;
+}
+
+std::string output_path(const std::string &out_dir, const std::string &in_path) {
+    size_t slash = in_path.find_last_of('/');
+    std::string name = slash == std::string::npos ? in_path : in_path.substr(slash + 1);
+    return out_dir + "/" + name;
+}
+
+int run_single(int argc, char **argv) {
     if (argc < 8) {
         printf("Usage: ./process raw.png color_temp gamma contrast sharpen timing_iterations output.png\n"
-               "e.g. ./process raw.png 3200 2 50 5 output.png");
+               "e.g. ./process raw.png 3200 2 50 5 output.png\n"
+               "       ./process --stream frames_dir_or_list color_temp gamma contrast sharpen queue_depth output_dir\n"
+               "       ./process --batch raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "       ./process --lut-cache raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "       ./process --strips raw.png color_temp gamma contrast sharpen band_rows output.png\n"
+               "       ./process --packed raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "       ./process --yuv raw.png color_temp gamma contrast sharpen timing_iterations output.nv12\n"
+               "       ./process --demosaic raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "       ./process --burst frames_dir_or_list color_temp gamma contrast sharpen merge_threshold band_rows output.png\n"
+               "       ./process --profile raw.png color_temp gamma contrast sharpen timing_iterations [report.json]\n"
+               "       ./process --memory raw.png color_temp gamma contrast sharpen timing_iterations [scratch_budget_kb]\n"
+               "       ./process --preview raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "       ./process --stats raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "       ./process --arena raw.png color_temp gamma contrast sharpen frames\n"
+               "       ./process --pool frames_dir_or_list color_temp gamma contrast sharpen in_flight output_dir\n"
+               "       ./process --cfa raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "       ./process --roi raw.png color_temp gamma contrast sharpen timing_iterations x y width height output.png\n"
+               "       ./process --jpeg raw.png color_temp gamma contrast sharpen band_rows timing_iterations\n");
         return 0;
     }
 
@@ -31,7 +228,7 @@ int main(int argc, char **argv) {
     fprintf(stderr, "input: %s\n", argv[1]);
     Buffer<uint16_t> input = load_and_convert_image(argv[1]);
     fprintf(stderr, "       %d %d\n", input.width(), input.height());
-    Buffer<uint8_t> output(((input.width() - 32)/32)*32, ((input.height() - 24)/32)*32, 3);
+    Buffer<uint8_t> output = make_output(input);
 
 #ifdef HL_MEMINFO
     info(input, "input");
@@ -39,44 +236,20 @@ int main(int argc, char **argv) {
     // dump(input, "input");
 #endif
 
-    // These color matrices are for the sensor in the Nokia N900 and are
-    // taken from the FCam source.
-    float _matrix_3200[][4] = {{ 1.6697f, -0.2693f, -0.4004f, -42.4346f},
-                                {-0.3576f,  1.0615f,  1.5949f, -37.1158f},
-                                {-0.2175f, -1.8751f,  6.9640f, -26.6970f}};
-
-    float _matrix_7000[][4] = {{ 2.2997f, -0.4478f,  0.1706f, -39.0923f},
-                                {-0.3826f,  1.5906f, -0.2080f, -25.4311f},
-                                {-0.0888f, -0.7344f,  2.2832f, -20.0826f}};
-    Buffer<float> matrix_3200(4, 3), matrix_7000(4, 3);
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 4; j++) {
-            matrix_3200(j, i) = _matrix_3200[i][j];
-            matrix_7000(j, i) = _matrix_7000[i][j];
-        }
-    }
-
-    float color_temp = (float) atof(argv[2]);
-    float gamma = (float) atof(argv[3]);
-    float contrast = (float) atof(argv[4]);
-    float sharpen = (float) atof(argv[5]);
+    PipeParams p = make_params(argv + 2);
     int timing_iterations = atoi(argv[6]);
-    int blackLevel = 25;
-    int whiteLevel = 1023;
 
     double best;
 
     best = benchmark(timing_iterations, 1, [&]() {
-        camera_pipe(input, matrix_3200, matrix_7000,
-                    color_temp, gamma, contrast, sharpen, blackLevel, whiteLevel,
-                    output);
+        run_camera_pipe(input, p, output);
     });
     fprintf(stderr, "Halide (manual):\t%gus\n", best * 1e6);
 
     #ifndef NO_AUTO_SCHEDULE
     best = benchmark(timing_iterations, 1, [&]() {
-        camera_pipe_auto_schedule(input, matrix_3200, matrix_7000,
-                                  color_temp, gamma, contrast, sharpen, blackLevel, whiteLevel,
+        camera_pipe_auto_schedule(input, p.matrix_3200, p.matrix_7000,
+                                  p.color_temp, p.gamma, p.contrast, p.sharpen, p.blackLevel, p.whiteLevel,
             output);
     });
     fprintf(stderr, "Halide (auto):\t%gus\n", best * 1e6);
@@ -88,3 +261,1446 @@ int main(int argc, char **argv) {
 
     return 0;
 }
+
+// Decode, camera_pipe and encode run as a three stage pipeline, one thread
+// each, connected by bounded queues. camera_pipe itself still fans out over
+// the Halide thread pool; the other two stages keep the cores busy while it
+// is waiting on I/O.
+int run_stream(int argc, char **argv) {
+    if (argc < 8) {
+        printf("Usage: ./process --stream frames_dir_or_list color_temp gamma contrast sharpen queue_depth output_dir\n"
+               "e.g. ./process --stream raw_frames/ 3200 2 50 5 4 out/\n");
+        return 0;
+    }
+
+    std::vector<std::string> paths = list_frames(argv[1]);
+    if (paths.empty()) {
+        fprintf(stderr, "No frames found in %s\n", argv[1]);
+        return -1;
+    }
+    PipeParams p = make_params(argv + 2);
+    int queue_depth = atoi(argv[6]);
+    std::string out_dir = argv[7];
+
+    FrameQueue<Frame> decoded(queue_depth), processed(queue_depth);
+    StageStats decode_stats, process_stats, encode_stats, latency_stats;
+    int failures = 0;
+
+    Clock::time_point stream_start = Clock::now();
+
+    std::thread decoder([&]() {
+        for (const std::string &path : paths) {
+            Frame f;
+            f.path = path;
+            f.start = Clock::now();
+            f.raw = load_and_convert_image(path);
+            decode_stats.samples.push_back(seconds_between(f.start, Clock::now()));
+            if (!decoded.push(std::move(f))) {
+                break;
+            }
+        }
+        decoded.close();
+    });
+
+    std::thread pipeline([&]() {
+        Frame f;
+        while (decoded.pop(f)) {
+            Clock::time_point t = Clock::now();
+            f.processed = make_output(f.raw);
+            if (run_camera_pipe(f.raw, p, f.processed) != 0) {
+                failures++;
+                continue;
+            }
+            process_stats.samples.push_back(seconds_between(t, Clock::now()));
+            // The raw frame is no longer needed; drop it before queueing so
+            // only decoded-but-unprocessed frames hold raw memory.
+            f.raw = Buffer<uint16_t>();
+            if (!processed.push(std::move(f))) {
+                break;
+            }
+        }
+        processed.close();
+    });
+
+    std::thread encoder([&]() {
+        Frame f;
+        while (processed.pop(f)) {
+            Clock::time_point t = Clock::now();
+            convert_and_save_image(f.processed, output_path(out_dir, f.path));
+            Clock::time_point done = Clock::now();
+            encode_stats.samples.push_back(seconds_between(t, done));
+            latency_stats.samples.push_back(seconds_between(f.start, done));
+        }
+    });
+
+    decoder.join();
+    pipeline.join();
+    encoder.join();
+
+    double elapsed = seconds_between(stream_start, Clock::now());
+    size_t frames = latency_stats.samples.size();
+    fprintf(stderr, "Streamed %zu/%zu frames in %gs: %.2f frames/sec sustained\n",
+            frames, paths.size(), elapsed, frames / elapsed);
+    decode_stats.report("decode");
+    process_stats.report("process");
+    encode_stats.report("encode");
+    latency_stats.report("latency");
+
+    return failures == 0 ? 0 : -1;
+}
+
+// Times N separate camera_pipe calls against one camera_pipe_batch call over
+// the same N frames.
+int run_batch(int argc, char **argv) {
+    if (argc < 7) {
+        printf("Usage: ./process --batch raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "e.g. ./process --batch raw.png 3200 2 50 5 10\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int timing_iterations = atoi(argv[6]);
+
+    const int batch_sizes[] = {1, 4, 16};
+    for (int frames : batch_sizes) {
+        Buffer<uint16_t> batch(input.width(), input.height(), frames);
+        std::vector<Buffer<uint8_t>> outputs;
+        for (int i = 0; i < frames; i++) {
+            batch.sliced(2, i).copy_from(input);
+            outputs.push_back(make_output(input));
+        }
+        Buffer<uint8_t> batch_output(outputs[0].width(), outputs[0].height(), 3, frames);
+
+        double single = benchmark(timing_iterations, 1, [&]() {
+            for (int i = 0; i < frames; i++) {
+                run_camera_pipe(input, p, outputs[i]);
+            }
+        });
+        double batched = benchmark(timing_iterations, 1, [&]() {
+            camera_pipe_batch(batch, p.matrix_3200, p.matrix_7000,
+                              p.color_temp, p.gamma, p.contrast, p.sharpen, p.blackLevel, p.whiteLevel,
+                              batch_output);
+        });
+        fprintf(stderr, "N = %2d: single calls %10gus (%gus/frame)  batched %10gus (%gus/frame)  speedup %.2fx\n",
+                frames, single * 1e6, single * 1e6 / frames,
+                batched * 1e6, batched * 1e6 / frames, single / batched);
+    }
+
+    return 0;
+}
+
+// Measures what caching the tone curve and color matrix saves per frame:
+// camera_pipe rebuilds both on every call, camera_pipe_prebaked gets them
+// from a LutCache that only misses on the first frame.
+int run_lut_cache(int argc, char **argv) {
+    if (argc < 7) {
+        printf("Usage: ./process --lut-cache raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "e.g. ./process --lut-cache ../images/bayer_small.png 3200 2 50 5 10\n"
+               "For a 1080p figure, pass a 16-bit raw of at least 1952 x 1112, e.g.\n"
+               "     ./process --lut-cache raw_1080p.png 3200 2 50 5 10\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int timing_iterations = atoi(argv[6]);
+    Buffer<uint8_t> output = make_output(input);
+    Buffer<uint8_t> output_cached = make_output(input);
+    fprintf(stderr, "input: %s (%d x %d)\n", argv[1], input.width(), input.height());
+
+    double uncached = benchmark(timing_iterations, 1, [&]() {
+        run_camera_pipe(input, p, output);
+    });
+
+    Buffer<uint8_t> curve_lut(1024);
+    Buffer<int16_t> matrix_q8(4, 3);
+    double bake = benchmark(timing_iterations, 1, [&]() {
+        camera_pipe_luts(p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                         p.blackLevel, p.whiteLevel, curve_lut, matrix_q8);
+    });
+
+    LutCache cache(p.matrix_3200, p.matrix_7000);
+    bool lookup_failed = false;
+    double cached = benchmark(timing_iterations, 1, [&]() {
+        LutCache::Entry *e = cache.lookup(p.color_temp, p.gamma, p.contrast, p.blackLevel, p.whiteLevel);
+        if (!e) {
+            lookup_failed = true;
+            return;
+        }
+        camera_pipe_prebaked(input, e->curve_lut, e->matrix_q8, p.sharpen, output_cached);
+    });
+    if (lookup_failed) {
+        fprintf(stderr, "camera_pipe_luts failed\n");
+        return -1;
+    }
+
+    int mismatches = 0;
+    output.for_each_element([&](int x, int y, int c) {
+        if (output(x, y, c) != output_cached(x, y, c)) {
+            mismatches++;
+        }
+    });
+
+    fprintf(stderr, "camera_pipe:          %gus\n", uncached * 1e6);
+    fprintf(stderr, "camera_pipe_luts:     %gus (paid once per parameter change)\n", bake * 1e6);
+    fprintf(stderr, "camera_pipe_prebaked: %gus (cache hits %zu, misses %zu)\n",
+            cached * 1e6, cache.hits, cache.misses);
+    fprintf(stderr, "Saved per frame:      %gus (%.1f%%)\n",
+            (uncached - cached) * 1e6, 100.0 * (uncached - cached) / uncached);
+    if (mismatches) {
+        fprintf(stderr, "Outputs differ in %d values\n", mismatches);
+        return -1;
+    }
+    return 0;
+}
+
+long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Processes a raw far larger than we want resident a band of rows at a time.
+// Raw rows are read incrementally into a window of band_rows + raw_halo_rows
+// rows, each band of output is written out as soon as it's done, and the
+// last raw_halo_rows rows of the window are kept for the next band. Peak
+// memory depends on the width and band_rows, not the height.
+int run_strips(int argc, char **argv) {
+    if (argc < 8) {
+        printf("Usage: ./process --strips raw.png color_temp gamma contrast sharpen band_rows output.png\n"
+               "e.g. ./process --strips huge_raw.png 3200 2 50 5 256 output.png\n");
+        return 0;
+    }
+
+    PngRowReader reader;
+    if (!reader.open(argv[1])) {
+        return -1;
+    }
+    PipeParams p = make_params(argv + 2);
+    // Bands have to respect the same multiple of 32 rows as a whole frame.
+    int band_rows = std::max(32, (atoi(argv[6]) / 32) * 32);
+
+    int out_width = ((reader.width - 32)/32)*32;
+    int out_height = ((reader.height - 24)/32)*32;
+    fprintf(stderr, "input: %s\n       %d %d, %d row bands\n", argv[1], reader.width, reader.height, band_rows);
+
+    PngRowWriter writer;
+    if (!writer.open(argv[7], out_width, out_height)) {
+        return -1;
+    }
+
+    Buffer<uint16_t> window(reader.width, band_rows + raw_halo_rows);
+    Buffer<uint8_t> band(out_width, band_rows, 3);
+    if (!reader.read_rows(window, 0, raw_halo_rows)) {
+        return -1;
+    }
+
+    double compute = 0;
+    Clock::time_point start = Clock::now();
+    for (int y = 0; y < out_height; y += band_rows) {
+        int rows = std::min(band_rows, out_height - y);
+        if (!reader.read_rows(window, raw_halo_rows, rows)) {
+            return -1;
+        }
+
+        // Both crops start at row 0, so the pipeline sees an ordinary
+        // (rows + halo)-row raw producing a rows-row image.
+        Buffer<uint16_t> raw_band = window.cropped(1, 0, rows + raw_halo_rows);
+        Buffer<uint8_t> out_band = band.cropped(1, 0, rows);
+        Clock::time_point t = Clock::now();
+        if (run_camera_pipe(raw_band, p, out_band) != 0) {
+            return -1;
+        }
+        compute += seconds_between(t, Clock::now());
+        if (!writer.write_rows(out_band)) {
+            return -1;
+        }
+
+        memmove(window.data(), window.data() + rows * reader.width,
+                raw_halo_rows * reader.width * sizeof(uint16_t));
+    }
+    if (!writer.finish()) {
+        return -1;
+    }
+
+    fprintf(stderr, "output: %s\n        %d %d\n", argv[7], out_width, out_height);
+    fprintf(stderr, "Total %gs, camera_pipe %gs, peak RSS %ld KB\n",
+            seconds_between(start, Clock::now()), compute, peak_rss_kb());
+    return 0;
+}
+
+// Packs a 10-bit raw into MIPI CSI-2 RAW10 (bits == 10) or, shifted up to
+// 12 bits, RAW12 rows. Values are clamped to 10 bits first, so unpacking in
+// camera_pipe_raw10/raw12 recovers exactly what camera_pipe sees.
+Buffer<uint8_t> pack_raw(Buffer<uint16_t> &raw, int bits) {
+    const int group_size = bits == 10 ? 4 : 2;
+    const int low_bits = bits - 8;
+    Buffer<uint8_t> packed(raw.width() / group_size * (group_size + 1), raw.height());
+    for (int y = 0; y < raw.height(); y++) {
+        for (int g = 0; g < raw.width() / group_size; g++) {
+            uint8_t low = 0;
+            for (int i = 0; i < group_size; i++) {
+                int v = std::min<int>(raw(g * group_size + i, y), 1023) << (bits - 10);
+                packed(g * (group_size + 1) + i, y) = v >> low_bits;
+                low |= (v & ((1 << low_bits) - 1)) << (i * low_bits);
+            }
+            packed(g * (group_size + 1) + group_size, y) = low;
+        }
+    }
+    return packed;
+}
+
+int run_packed(int argc, char **argv) {
+    if (argc < 7) {
+        printf("Usage: ./process --packed raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "e.g. ./process --packed ../images/bayer_small.png 3200 2 50 5 10\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int timing_iterations = atoi(argv[6]);
+    fprintf(stderr, "input: %s (%d x %d)\n", argv[1], input.width(), input.height());
+
+    // Reference: the same clamped 10-bit values, unpacked ahead of time.
+    Buffer<uint16_t> clamped(input.width(), input.height());
+    clamped.for_each_element([&](int x, int y) {
+        clamped(x, y) = std::min<int>(input(x, y), 1023);
+    });
+    Buffer<uint8_t> expected = make_output(input);
+    double unpacked_time = benchmark(timing_iterations, 1, [&]() {
+        run_camera_pipe(clamped, p, expected);
+    });
+    fprintf(stderr, "camera_pipe (uint16_t input): %gus, %zu input bytes\n",
+            unpacked_time * 1e6, clamped.size_in_bytes());
+
+    int result = 0;
+    for (int bits : {10, 12}) {
+        Buffer<uint8_t> packed = pack_raw(input, bits);
+        Buffer<uint8_t> output = make_output(input);
+        double t = benchmark(timing_iterations, 1, [&]() {
+            auto pipe = bits == 10 ? camera_pipe_raw10 : camera_pipe_raw12;
+            pipe(packed, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                 p.sharpen, p.blackLevel, p.whiteLevel, output);
+        });
+
+        int mismatches = 0;
+        output.for_each_element([&](int x, int y, int c) {
+            if (output(x, y, c) != expected(x, y, c)) {
+                mismatches++;
+            }
+        });
+        fprintf(stderr, "camera_pipe_raw%d:             %gus, %zu input bytes\n",
+                bits, t * 1e6, packed.size_in_bytes());
+        if (mismatches) {
+            fprintf(stderr, "RAW%d output differs in %d values\n", bits, mismatches);
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// The separate conversion pass camera_pipe_nv12/i420 replace, with the same
+// BT.601 limited range arithmetic. chroma is (x, y, c), c = 0 for Cb.
+void rgb_to_yuv420(const Buffer<uint8_t> &rgb, Buffer<uint8_t> &luma, Buffer<uint8_t> &chroma) {
+    for (int y = 0; y < luma.height(); y++) {
+        for (int x = 0; x < luma.width(); x++) {
+            int r = rgb(x, y, 0), g = rgb(x, y, 1), b = rgb(x, y, 2);
+            luma(x, y) = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        }
+    }
+    for (int y = 0; y < chroma.height(); y++) {
+        for (int x = 0; x < chroma.width(); x++) {
+            int avg[3];
+            for (int c = 0; c < 3; c++) {
+                avg[c] = (rgb(2*x, 2*y, c) + rgb(2*x + 1, 2*y, c) +
+                          rgb(2*x, 2*y + 1, c) + rgb(2*x + 1, 2*y + 1, c) + 2) / 4;
+            }
+            chroma(x, y, 0) = ((-38 * avg[0] - 74 * avg[1] + 112 * avg[2] + 128) >> 8) + 128;
+            chroma(x, y, 1) = ((112 * avg[0] - 94 * avg[1] - 18 * avg[2] + 128) >> 8) + 128;
+        }
+    }
+}
+
+int run_yuv(int argc, char **argv) {
+    if (argc < 8) {
+        printf("Usage: ./process --yuv raw.png color_temp gamma contrast sharpen timing_iterations output.nv12\n"
+               "e.g. ./process --yuv ../images/bayer_small.png 3200 2 50 5 10 output.nv12\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int timing_iterations = atoi(argv[6]);
+    Buffer<uint8_t> rgb = make_output(input);
+    fprintf(stderr, "input: %s (%d x %d)\n", argv[1], input.width(), input.height());
+
+    // One allocation per frame, laid out as the formats define: the Y plane,
+    // then interleaved CbCr (NV12) or the Cb plane and the Cr plane (I420).
+    const int w = rgb.width(), h = rgb.height();
+    std::vector<uint8_t> nv12_frame(w * h * 3 / 2), i420_frame(w * h * 3 / 2);
+    halide_dimension_t luma_shape[] = {{0, w, 1}, {0, h, w}};
+    halide_dimension_t nv12_chroma_shape[] = {{0, w / 2, 2}, {0, h / 2, w}, {0, 2, 1}};
+    halide_dimension_t i420_chroma_shape[] = {{0, w / 2, 1}, {0, h / 2, w / 2}, {0, 2, w * h / 4}};
+    Buffer<uint8_t> nv12_luma(nv12_frame.data(), 2, luma_shape);
+    Buffer<uint8_t> nv12_chroma(nv12_frame.data() + w * h, 3, nv12_chroma_shape);
+    Buffer<uint8_t> i420_luma(i420_frame.data(), 2, luma_shape);
+    Buffer<uint8_t> i420_chroma(i420_frame.data() + w * h, 3, i420_chroma_shape);
+
+    Buffer<uint8_t> ref_luma(w, h), ref_chroma(w / 2, h / 2, 2);
+    double two_pass = benchmark(timing_iterations, 1, [&]() {
+        run_camera_pipe(input, p, rgb);
+        rgb_to_yuv420(rgb, ref_luma, ref_chroma);
+    });
+
+    double nv12 = benchmark(timing_iterations, 1, [&]() {
+        camera_pipe_nv12(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                         p.sharpen, p.blackLevel, p.whiteLevel, nv12_luma, nv12_chroma);
+    });
+    double i420 = benchmark(timing_iterations, 1, [&]() {
+        camera_pipe_i420(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                         p.sharpen, p.blackLevel, p.whiteLevel, i420_luma, i420_chroma);
+    });
+
+    int mismatches = 0;
+    ref_luma.for_each_element([&](int x, int y) {
+        mismatches += nv12_luma(x, y) != ref_luma(x, y);
+        mismatches += i420_luma(x, y) != ref_luma(x, y);
+    });
+    ref_chroma.for_each_element([&](int x, int y, int c) {
+        mismatches += nv12_chroma(x, y, c) != ref_chroma(x, y, c);
+        mismatches += i420_chroma(x, y, c) != ref_chroma(x, y, c);
+    });
+
+    fprintf(stderr, "camera_pipe + conversion: %gus, %zu output bytes\n",
+            two_pass * 1e6, rgb.size_in_bytes());
+    fprintf(stderr, "camera_pipe_nv12:         %gus, %zu output bytes\n", nv12 * 1e6, nv12_frame.size());
+    fprintf(stderr, "camera_pipe_i420:         %gus, %zu output bytes\n", i420 * 1e6, i420_frame.size());
+
+    std::ofstream out(argv[7], std::ios::binary);
+    out.write((const char *)nv12_frame.data(), nv12_frame.size());
+    fprintf(stderr, "output: %s (NV12, %d x %d)\n", argv[7], w, h);
+
+    if (mismatches) {
+        fprintf(stderr, "YUV output differs from camera_pipe + conversion in %d values\n", mismatches);
+        return -1;
+    }
+    return 0;
+}
+
+double psnr(const Buffer<uint8_t> &a, const Buffer<uint8_t> &b) {
+    double squared_error = 0;
+    a.for_each_element([&](int x, int y, int c) {
+        double d = (double)a(x, y, c) - b(x, y, c);
+        squared_error += d * d;
+    });
+    double mse = squared_error / a.number_of_elements();
+    return mse == 0 ? INFINITY : 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+int run_demosaic(int argc, char **argv) {
+    if (argc < 7) {
+        printf("Usage: ./process --demosaic raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "e.g. ./process --demosaic ../images/bayer_small.png 3200 2 50 5 10\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int timing_iterations = atoi(argv[6]);
+    fprintf(stderr, "input: %s (%d x %d)\n", argv[1], input.width(), input.height());
+
+    typedef int (*Pipeline)(halide_buffer_t *, halide_buffer_t *, halide_buffer_t *,
+                            float, float, float, float, int, int, halide_buffer_t *);
+    struct Engine {
+        const char *name;
+        Pipeline pipeline;
+    };
+    // The first is the reference the others are compared against.
+    const Engine engines[] = {
+        {"edge_directed", camera_pipe},
+        {"malvar", camera_pipe_malvar},
+        {"ahd", camera_pipe_ahd},
+    };
+
+    Buffer<uint8_t> reference = make_output(input);
+    for (const Engine &e : engines) {
+        Buffer<uint8_t> output = make_output(input);
+        Buffer<uint8_t> &result = e.pipeline == camera_pipe ? reference : output;
+        double t = benchmark(timing_iterations, 1, [&]() {
+            e.pipeline(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                       p.sharpen, p.blackLevel, p.whiteLevel, result);
+        });
+        double mpix = result.width() * result.height() / 1e6;
+        fprintf(stderr, "%-14s %8.2f MP/s  PSNR vs edge_directed %6.2f dB\n",
+                e.name, mpix / t, psnr(result, reference));
+    }
+    return 0;
+}
+
+// How far alignment can move a tile, 81 gray pixels or 162 raw rows,
+// rounded up to whole 32-row alignment tiles. Each band's window of the
+// burst reaches this far above and below the band's own raw.
+const int burst_align_rows = 192;
+
+// Merges a burst a band of rows at a time. Every frame is read
+// incrementally, like --strips, into a window of the rows the band needs
+// plus burst_align_rows either side, and camera_pipe_burst turns the
+// windows of all N frames into one band of output. So the raw held at once
+// is N windows, however tall the frames are.
+int run_burst(int argc, char **argv) {
+    if (argc < 9) {
+        printf("Usage: ./process --burst frames_dir_or_list color_temp gamma contrast sharpen merge_threshold band_rows output.png\n"
+               "e.g. ./process --burst burst/ 3200 2 50 5 24 256 merged.png\n");
+        return 0;
+    }
+
+    // The first frame in order is the reference.
+    std::vector<std::string> paths = list_frames(argv[1]);
+    if (paths.empty()) {
+        fprintf(stderr, "No frames found in %s\n", argv[1]);
+        return -1;
+    }
+    PipeParams p = make_params(argv + 2);
+    float merge_threshold = atof(argv[6]);
+    if (!(merge_threshold > 0)) {
+        fprintf(stderr, "merge_threshold must be greater than 0\n");
+        return -1;
+    }
+    // Bands are whole alignment tiles, and a multiple of 32 rows like a
+    // whole frame.
+    int band_rows = std::max(32, (atoi(argv[7]) / 32) * 32);
+
+    const int frames = (int)paths.size();
+    std::vector<PngRowReader> readers(frames);
+    for (int i = 0; i < frames; i++) {
+        if (!readers[i].open(paths[i])) {
+            return -1;
+        }
+        if (readers[i].width != readers[0].width || readers[i].height != readers[0].height) {
+            fprintf(stderr, "%s is not the same size as %s\n", paths[i].c_str(), paths[0].c_str());
+            return -1;
+        }
+    }
+    const int width = readers[0].width, height = readers[0].height;
+    int out_width = ((width - 32)/32)*32;
+    int out_height = ((height - 24)/32)*32;
+    fprintf(stderr, "burst: %d frames of %d x %d, %d row bands\n", frames, width, height, band_rows);
+
+    PngRowWriter writer;
+    if (!writer.open(argv[8], out_width, out_height)) {
+        return -1;
+    }
+
+    // Global rows [window_start, window_end) of every frame are in rows
+    // [0, window_end - window_start) of its slice of window.
+    int capacity = band_rows + raw_halo_rows + 2 * burst_align_rows;
+    Buffer<uint16_t> window(width, capacity, frames);
+    Buffer<uint8_t> band(out_width, band_rows, 3);
+    int window_start = 0, window_end = 0;
+
+    double compute = 0;
+    Clock::time_point start = Clock::now();
+    for (int y = 0; y < out_height; y += band_rows) {
+        int rows = std::min(band_rows, out_height - y);
+        int new_start = std::max(0, y - burst_align_rows);
+        int new_end = std::min(height, y + rows + raw_halo_rows + burst_align_rows);
+        for (int i = 0; i < frames; i++) {
+            Buffer<uint16_t> frame = window.sliced(2, i);
+            memmove(frame.data(), frame.data() + (new_start - window_start) * width,
+                    (window_end - new_start) * width * sizeof(uint16_t));
+            if (!readers[i].read_rows(frame, window_end - new_start, new_end - window_end)) {
+                return -1;
+            }
+        }
+        window_start = new_start;
+        window_end = new_end;
+
+        Buffer<uint16_t> raw_window = window.cropped(1, 0, window_end - window_start);
+        Buffer<uint8_t> out_band = band.cropped(1, 0, rows);
+        Clock::time_point t = Clock::now();
+        if (camera_pipe_burst(raw_window, y - window_start, p.matrix_3200, p.matrix_7000,
+                              p.color_temp, p.gamma, p.contrast, p.sharpen, p.blackLevel, p.whiteLevel,
+                              merge_threshold, out_band) != 0) {
+            return -1;
+        }
+        compute += seconds_between(t, Clock::now());
+        if (!writer.write_rows(out_band)) {
+            return -1;
+        }
+    }
+    if (!writer.finish()) {
+        return -1;
+    }
+
+    fprintf(stderr, "output: %s\n        %d %d\n", argv[8], out_width, out_height);
+    fprintf(stderr, "Total %gs, camera_pipe_burst %gs\n", seconds_between(start, Clock::now()), compute);
+    fprintf(stderr, "Raw resident: %zu KB of windows (a whole burst would be %zu KB), peak RSS %ld KB\n",
+            window.size_in_bytes() / 1024, (size_t)width * height * frames * sizeof(uint16_t) / 1024,
+            peak_rss_kb());
+    return 0;
+}
+
+// Stage names as the profiler sees them, where they differ from the name
+// of the stage in camera_pipe_generator.cpp.
+const char *profiled_stage_name(const char *func) {
+    // sharpened is inlined into the output
+    if (strcmp(func, "processed") == 0) {
+        return "processed (sharpened)";
+    }
+    return func;
+}
+
+int run_profile(int argc, char **argv) {
+    if (argc < 7) {
+        printf("Usage: ./process --profile raw.png color_temp gamma contrast sharpen timing_iterations [report.json]\n"
+               "e.g. ./process --profile ../images/bayer_small.png 3200 2 50 5 10 profile.json\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int timing_iterations = atoi(argv[6]);
+    Buffer<uint8_t> output = make_output(input);
+    fprintf(stderr, "input: %s (%d x %d)\n", argv[1], input.width(), input.height());
+
+    // Warm up outside of the profile, then start from clean counters.
+    camera_pipe_profiled(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                         p.sharpen, p.blackLevel, p.whiteLevel, output);
+    halide_profiler_reset();
+    for (int i = 0; i < timing_iterations; i++) {
+        camera_pipe_profiled(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                             p.sharpen, p.blackLevel, p.whiteLevel, output);
+    }
+
+    halide_profiler_state *state = halide_profiler_get_state();
+    halide_mutex_lock(&state->lock);
+    halide_profiler_pipeline_stats *pipeline = state->pipelines;
+    while (pipeline && strcmp(pipeline->name, "camera_pipe_profiled") != 0) {
+        pipeline = (halide_profiler_pipeline_stats *)pipeline->next;
+    }
+    if (!pipeline || pipeline->runs == 0) {
+        halide_mutex_unlock(&state->lock);
+        fprintf(stderr, "No profile recorded for camera_pipe_profiled\n");
+        return -1;
+    }
+
+    auto threads = [](uint64_t numerator, uint64_t denominator) {
+        return denominator ? (double)numerator / denominator : 0.0;
+    };
+    double ms_per_run = pipeline->time / 1e6 / pipeline->runs;
+    fprintf(stderr, "%s: %d runs, %.3fms per run, %.2f threads on average, peak heap %llu bytes\n",
+            pipeline->name, pipeline->runs, ms_per_run,
+            threads(pipeline->active_threads_numerator, pipeline->active_threads_denominator),
+            (unsigned long long)pipeline->memory_peak);
+    fprintf(stderr, "  %-24s %10s %7s %8s %12s %12s %7s\n",
+            "func", "ms/run", "%", "threads", "peak heap", "peak stack", "allocs");
+
+    FILE *json = nullptr;
+    if (argc > 7) {
+        json = fopen(argv[7], "w");
+        if (!json) {
+            fprintf(stderr, "Could not open %s\n", argv[7]);
+        }
+    }
+    if (json) {
+        fprintf(json, "{\n  \"pipeline\": \"%s\",\n  \"runs\": %d,\n  \"ms_per_run\": %g,\n"
+                      "  \"threads\": %g,\n  \"peak_heap_bytes\": %llu,\n  \"funcs\": [",
+                pipeline->name, pipeline->runs, ms_per_run,
+                threads(pipeline->active_threads_numerator, pipeline->active_threads_denominator),
+                (unsigned long long)pipeline->memory_peak);
+    }
+
+    bool first = true;
+    for (int i = 0; i < pipeline->num_funcs; i++) {
+        const halide_profiler_func_stats &f = pipeline->funcs[i];
+        if (f.time == 0 && f.memory_peak == 0 && f.stack_peak == 0) {
+            continue;
+        }
+        const char *name = profiled_stage_name(f.name);
+        double func_ms = f.time / 1e6 / pipeline->runs;
+        double percent = pipeline->time ? 100.0 * f.time / pipeline->time : 0.0;
+        double func_threads = threads(f.active_threads_numerator, f.active_threads_denominator);
+        fprintf(stderr, "  %-24s %10.3f %6.1f%% %8.2f %12llu %12llu %7d\n",
+                name, func_ms, percent, func_threads,
+                (unsigned long long)f.memory_peak, (unsigned long long)f.stack_peak, f.num_allocs);
+        if (json) {
+            fprintf(json, "%s\n    {\"name\": \"%s\", \"ms_per_run\": %g, \"percent\": %g, \"threads\": %g, "
+                          "\"peak_heap_bytes\": %llu, \"peak_stack_bytes\": %llu, \"allocs\": %d}",
+                    first ? "" : ",", name, func_ms, percent, func_threads,
+                    (unsigned long long)f.memory_peak, (unsigned long long)f.stack_peak, f.num_allocs);
+        }
+        first = false;
+    }
+    halide_mutex_unlock(&state->lock);
+
+    if (json) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+        fprintf(stderr, "report: %s\n", argv[7]);
+    }
+
+    // Otherwise the runtime prints its own report again at exit.
+    halide_profiler_reset();
+    return 0;
+}
+
+// A folded Func's entry in camera_pipe_fold.h, by its name as the profiler
+// sees it.
+const FoldedStorage *find_folded_storage(const char *func) {
+    for (const FoldedStorage &f : folded_storage) {
+        size_t n = strlen(f.func);
+        // Funcs may be uniquified with a $n suffix
+        if (strncmp(func, f.func, n) == 0 && (func[n] == '\0' || func[n] == '$')) {
+            return &f;
+        }
+    }
+    return nullptr;
+}
+
+// Runs the profiled builds of camera_pipe, with the edge-directed and AHD
+// demosaics, through the malloc trace, and reports heap use for the whole
+// pipeline, each thread and each Func. Returns non-zero if any folded
+// intermediate's allocations are bigger than its fold in camera_pipe_fold.h
+// allows (plus 64 values a row for the stencil halo and rounding up to
+// whole tiles), or a thread's scratch exceeds the optional budget, so it can
+// catch a schedule change that quietly stops folding.
+int run_memory(int argc, char **argv) {
+    if (argc < 7) {
+        printf("Usage: ./process --memory raw.png color_temp gamma contrast sharpen timing_iterations [scratch_budget_kb]\n"
+               "e.g. ./process --memory ../images/bayer_small.png 3200 2 50 5 10 1024\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int timing_iterations = std::max(1, atoi(argv[6]));
+    size_t scratch_budget = argc > 7 ? (size_t)atoi(argv[7]) * 1024 : 0;
+    Buffer<uint8_t> output = make_output(input);
+    fprintf(stderr, "input: %s (%d x %d)\n", argv[1], input.width(), input.height());
+
+    typedef int (*Pipeline)(halide_buffer_t *, halide_buffer_t *, halide_buffer_t *,
+                            float, float, float, float, int, int, halide_buffer_t *);
+    const struct {
+        const char *name;
+        Pipeline pipeline;
+    } builds[] = {
+        {"camera_pipe_profiled", camera_pipe_profiled},
+        {"camera_pipe_ahd_profiled", camera_pipe_ahd_profiled},
+    };
+
+    // The accounting sits on top of the HL_MEMINFO malloc trace, which does
+    // the allocating (and logs each call to stdout).
+    halide_enable_malloc_trace();
+    MemoryTrace &trace = MemoryTrace::instance();
+    trace.install();
+
+    int flagged = 0;
+    for (const auto &build : builds) {
+        halide_profiler_reset();
+        trace.reset();
+        for (int i = 0; i < timing_iterations; i++) {
+            build.pipeline(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                           p.sharpen, p.blackLevel, p.whiteLevel, output);
+        }
+
+        MemoryTrace::Usage total = trace.get_total();
+        fprintf(stderr, "%s heap: %.1f allocations per run, peak live %zu bytes, largest allocation %zu bytes\n",
+                build.name, (double)total.allocs / timing_iterations, total.peak_bytes, total.largest);
+
+        fprintf(stderr, "  %-24s %12s %12s\n", "thread", "peak scratch", "allocs/run");
+        int thread_index = 0;
+        for (const auto &t : trace.get_threads()) {
+            const MemoryTrace::Usage &u = t.second;
+            bool over = scratch_budget && u.peak_bytes > scratch_budget;
+            fprintf(stderr, "  %-24d %12zu %12.1f%s\n", thread_index++, u.peak_bytes,
+                    (double)u.allocs / timing_iterations, over ? "  over budget" : "");
+            flagged += over;
+        }
+
+        halide_profiler_state *state = halide_profiler_get_state();
+        halide_mutex_lock(&state->lock);
+        halide_profiler_pipeline_stats *pipeline = state->pipelines;
+        while (pipeline && strcmp(pipeline->name, build.name) != 0) {
+            pipeline = (halide_profiler_pipeline_stats *)pipeline->next;
+        }
+        if (!pipeline || pipeline->runs == 0) {
+            halide_mutex_unlock(&state->lock);
+            trace.uninstall();
+            fprintf(stderr, "No profile recorded for %s\n", build.name);
+            return -1;
+        }
+
+        fprintf(stderr, "  %-24s %12s %12s %12s %12s\n",
+                "func", "peak heap", "per alloc", "peak stack", "expected");
+        for (int i = 0; i < pipeline->num_funcs; i++) {
+            const halide_profiler_func_stats &f = pipeline->funcs[i];
+            if (f.memory_peak == 0 && f.stack_peak == 0) {
+                continue;
+            }
+            uint64_t per_alloc = f.num_allocs ? f.memory_total / f.num_allocs : f.stack_peak;
+            const FoldedStorage *folded = find_folded_storage(f.name);
+            if (!folded) {
+                fprintf(stderr, "  %-24s %12llu %12llu %12llu\n", profiled_stage_name(f.name),
+                        (unsigned long long)f.memory_peak, (unsigned long long)per_alloc,
+                        (unsigned long long)f.stack_peak);
+                continue;
+            }
+            int row_values = (folded->half_width ? output.width() / 2 : output.width()) + 64;
+            uint64_t expected = (uint64_t)folded->fold_rows * row_values * folded->channels * folded->bytes_per_value;
+            bool over = per_alloc > expected;
+            fprintf(stderr, "  %-24s %12llu %12llu %12llu %12llu%s\n", f.name,
+                    (unsigned long long)f.memory_peak, (unsigned long long)per_alloc,
+                    (unsigned long long)f.stack_peak, (unsigned long long)expected,
+                    over ? "  exceeds folded footprint" : "");
+            flagged += over;
+        }
+        halide_mutex_unlock(&state->lock);
+    }
+    trace.uninstall();
+    halide_profiler_reset();
+
+    if (flagged) {
+        fprintf(stderr, "%d Funcs or threads over their expected footprint or budget\n", flagged);
+        return -1;
+    }
+    return 0;
+}
+
+// The separate downsampling pass camera_pipe_preview replaces: the rounded
+// mean of each factor x factor block.
+void downsample(const Buffer<uint8_t> &in, Buffer<uint8_t> &out, int factor) {
+    for (int c = 0; c < out.channels(); c++) {
+        for (int y = 0; y < out.height(); y++) {
+            for (int x = 0; x < out.width(); x++) {
+                uint32_t sum = 0;
+                for (int j = 0; j < factor; j++) {
+                    for (int i = 0; i < factor; i++) {
+                        sum += in(x * factor + i, y * factor + j, c);
+                    }
+                }
+                out(x, y, c) = (sum + factor * factor / 2) / (factor * factor);
+            }
+        }
+    }
+}
+
+int run_preview(int argc, char **argv) {
+    if (argc < 7) {
+        printf("Usage: ./process --preview raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "e.g. ./process --preview ../images/bayer_small.png 3200 2 50 5 10\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int timing_iterations = atoi(argv[6]);
+    fprintf(stderr, "input: %s (%d x %d)\n", argv[1], input.width(), input.height());
+
+    int result = 0;
+    for (int factor : {4, 8}) {
+        Buffer<uint8_t> output = make_output(input);
+        Buffer<uint8_t> preview(output.width() / factor, output.height() / factor, 3);
+        double two_pass = benchmark(timing_iterations, 1, [&]() {
+            run_camera_pipe(input, p, output);
+            downsample(output, preview, factor);
+        });
+
+        Buffer<uint8_t> fused_output = make_output(input);
+        Buffer<uint8_t> fused_preview(preview.width(), preview.height(), 3);
+        double fused = benchmark(timing_iterations, 1, [&]() {
+            auto pipe = factor == 4 ? camera_pipe_preview4 : camera_pipe_preview8;
+            pipe(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                 p.sharpen, p.blackLevel, p.whiteLevel, fused_output, fused_preview);
+        });
+
+        int mismatches = 0;
+        output.for_each_element([&](int x, int y, int c) {
+            mismatches += output(x, y, c) != fused_output(x, y, c);
+        });
+        preview.for_each_element([&](int x, int y, int c) {
+            mismatches += preview(x, y, c) != fused_preview(x, y, c);
+        });
+
+        fprintf(stderr, "1/%d preview: camera_pipe + downsample %gus, camera_pipe_preview%d %gus\n",
+                factor, two_pass * 1e6, factor, fused * 1e6);
+        if (mismatches) {
+            fprintf(stderr, "camera_pipe_preview%d differs from the two pass result in %d values\n",
+                    factor, mismatches);
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// camera_pipe's raw after its shift and hot pixel suppression, at the site
+// of output pixel (x, y).
+int denoised_raw(const Buffer<uint16_t> &input, int x, int y) {
+    auto shifted = [&](int x, int y) {
+        return (int)(int16_t)input(x + 16, y + 12);
+    };
+    int a = std::max(std::max(shifted(x - 2, y), shifted(x + 2, y)),
+                     std::max(shifted(x, y - 2), shifted(x, y + 2)));
+    return std::min(std::max(shifted(x, y), 0), a);
+}
+
+// The separate scan camera_pipe_stats replaces: the histogram of each
+// channel of camera_pipe's deinterleaved raw, with the same shift and hot
+// pixel suppression, for an output of out_width x out_height.
+void raw_histogram(const Buffer<uint16_t> &input, int out_width, int out_height, Buffer<uint32_t> &histogram) {
+    histogram.fill(0);
+    for (int y = 0; y < out_height; y++) {
+        for (int x = 0; x < out_width; x++) {
+            int v = denoised_raw(input, x, y);
+            int c = (x & 1) + 2 * (y & 1);
+            histogram(std::min(std::max(v >> 2, 0), 255), c)++;
+        }
+    }
+}
+
+// An estimate of camera_pipe_stats' zone_means straight from the raw: each
+// output pixel takes the red, blue and mean green of its Bayer quad, through
+// the same Q8.8 color matrix. This skips the demosaic, which moves a zone's
+// mean only a little, so the two agree within a few percent, while a wrong
+// zone index or area would be far off.
+void raw_zone_means(const Buffer<uint16_t> &input, PipeParams &p, int out_width, int out_height,
+                    Buffer<float> &means) {
+    int zones_x = means.width(), zones_y = means.height();
+    float alpha = (1.0f / p.color_temp - 1.0f / 3200) / (1.0f / 7000 - 1.0f / 3200);
+    int matrix[4][3];
+    for (int y = 0; y < 3; y++) {
+        for (int x = 0; x < 4; x++) {
+            float val = p.matrix_3200(x, y) * alpha + p.matrix_7000(x, y) * (1 - alpha);
+            matrix[x][y] = (int16_t)(val * 256.0f);
+        }
+    }
+
+    std::vector<double> sums(zones_x * zones_y * 3, 0.0);
+    std::vector<int> counts(zones_x * zones_y, 0);
+    for (int y = 0; y < out_height; y++) {
+        for (int x = 0; x < out_width; x++) {
+            // Default GRBG layout; the shift keeps quads at even sites.
+            int qx = x & ~1, qy = y & ~1;
+            float rgb[3] = {(float)denoised_raw(input, qx + 1, qy),
+                            (denoised_raw(input, qx, qy) + denoised_raw(input, qx + 1, qy + 1)) / 2.0f,
+                            (float)denoised_raw(input, qx, qy + 1)};
+            int zone = (y * zones_y / out_height) * zones_x + x * zones_x / out_width;
+            for (int c = 0; c < 3; c++) {
+                sums[zone * 3 + c] += (matrix[3][c] + matrix[0][c] * rgb[0] +
+                                       matrix[1][c] * rgb[1] + matrix[2][c] * rgb[2]) / 256.0f;
+            }
+            counts[zone]++;
+        }
+    }
+    means.for_each_element([&](int zx, int zy, int c) {
+        int zone = zy * zones_x + zx;
+        means(zx, zy, c) = sums[zone * 3 + c] / counts[zone];
+    });
+}
+
+int run_stats(int argc, char **argv) {
+    if (argc < 7) {
+        printf("Usage: ./process --stats raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "e.g. ./process --stats ../images/bayer_small.png 3200 2 50 5 10\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int timing_iterations = atoi(argv[6]);
+    fprintf(stderr, "input: %s (%d x %d)\n", argv[1], input.width(), input.height());
+
+    Buffer<uint8_t> output = make_output(input);
+    Buffer<uint32_t> histogram(256, 4);
+    double separate = benchmark(timing_iterations, 1, [&]() {
+        run_camera_pipe(input, p, output);
+        raw_histogram(input, output.width(), output.height(), histogram);
+    });
+
+    Buffer<uint8_t> fused_output = make_output(input);
+    Buffer<uint32_t> fused_histogram(256, 4);
+    Buffer<float> zone_means(16, 12, 3);
+    double fused = benchmark(timing_iterations, 1, [&]() {
+        camera_pipe_stats(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                          p.sharpen, p.blackLevel, p.whiteLevel, fused_output, fused_histogram, zone_means);
+    });
+
+    fprintf(stderr, "camera_pipe + histogram scan: %gus\ncamera_pipe_stats: %gus\n",
+            separate * 1e6, fused * 1e6);
+
+    int mismatches = 0;
+    output.for_each_element([&](int x, int y, int c) {
+        mismatches += output(x, y, c) != fused_output(x, y, c);
+    });
+    histogram.for_each_element([&](int b, int c) {
+        mismatches += histogram(b, c) != fused_histogram(b, c);
+    });
+    if (mismatches) {
+        fprintf(stderr, "camera_pipe_stats differs from the separate scan in %d values\n", mismatches);
+        return -1;
+    }
+
+    Buffer<float> expected_means(zone_means.width(), zone_means.height(), 3);
+    raw_zone_means(input, p, output.width(), output.height(), expected_means);
+    int far_zones = 0;
+    zone_means.for_each_element([&](int zx, int zy, int c) {
+        float expected = expected_means(zx, zy, c);
+        far_zones += fabsf(zone_means(zx, zy, c) - expected) > 0.05f * fabsf(expected) + 4;
+    });
+    if (far_zones) {
+        fprintf(stderr, "%d zone means differ from the raw estimate by more than 5%%\n", far_zones);
+        return -1;
+    }
+
+    // What an AWB loop would start from: the frame's mean linear RGB.
+    float mean[3] = {0, 0, 0};
+    zone_means.for_each_element([&](int zx, int zy, int c) {
+        mean[c] += zone_means(zx, zy, c) / (zone_means.width() * zone_means.height());
+    });
+    fprintf(stderr, "mean of zone means: r %.1f g %.1f b %.1f\n", mean[0], mean[1], mean[2]);
+    return 0;
+}
+
+// Streams the same raw through camera_pipe with Halide's scratch allocated
+// from the system as usual, then from the pooled arena, and compares the
+// steady state (every frame after the first) of the two.
+// Returns non-zero if, with the arena, any frame after the first allocates
+// from the system.
+int run_arena(int argc, char **argv) {
+    if (argc < 7) {
+        printf("Usage: ./process --arena raw.png color_temp gamma contrast sharpen frames\n"
+               "e.g. ./process --arena ../images/bayer_small.png 3200 2 50 5 100\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int frames = std::max(2, atoi(argv[6]));
+    Buffer<uint8_t> output = make_output(input);
+    fprintf(stderr, "input: %s (%d x %d), %d frames\n", argv[1], input.width(), input.height(), frames);
+
+    ArenaAllocator &arena = ArenaAllocator::instance();
+    arena.install();
+    int result = 0;
+    for (bool pooling : {false, true}) {
+        arena.set_pooling(pooling);
+        arena.reset_counts();
+        StageStats latency;
+        ArenaAllocator::Counts first;
+        for (int i = 0; i < frames && result == 0; i++) {
+            Clock::time_point t = Clock::now();
+            result = run_camera_pipe(input, p, output);
+            if (i == 0) {
+                first = arena.get_counts();
+                arena.reset_counts();
+            } else {
+                latency.samples.push_back(seconds_between(t, Clock::now()));
+            }
+        }
+        ArenaAllocator::Counts steady = arena.get_counts();
+        fprintf(stderr, "%s: first frame %zu allocations (%zu from the system), "
+                        "then %.1f per frame (%.1f from the system), %zu KB reserved\n",
+                pooling ? "arena" : "system", first.mallocs, first.system_mallocs,
+                (double)steady.mallocs / (frames - 1), (double)steady.system_mallocs / (frames - 1),
+                steady.reserved_bytes / 1024);
+        latency.report("latency");
+        arena.release();
+        // The point of the arena: once the first frame has filled the free
+        // lists, the system allocator is never called again.
+        if (pooling && result == 0 && steady.system_mallocs != 0) {
+            fprintf(stderr, "arena: %zu allocations reached the system after the first frame\n",
+                    steady.system_mallocs);
+            result = -1;
+        }
+    }
+    arena.uninstall();
+    return result;
+}
+
+// Runs in_flight frames at a time through load, camera_pipe and save, first
+// on host threads alongside the Halide runtime's thread pool, then as tasks
+// on a WorkStealingPool that also runs camera_pipe's parallel loops, and
+// compares the per-frame latency of the two.
+int run_pool(int argc, char **argv) {
+    if (argc < 8) {
+        printf("Usage: ./process --pool frames_dir_or_list color_temp gamma contrast sharpen in_flight output_dir\n"
+               "e.g. ./process --pool raw_frames/ 3200 2 50 5 4 out/\n");
+        return 0;
+    }
+
+    std::vector<std::string> paths = list_frames(argv[1]);
+    if (paths.empty()) {
+        fprintf(stderr, "No frames found in %s\n", argv[1]);
+        return -1;
+    }
+    PipeParams p = make_params(argv + 2);
+    int in_flight = std::max(1, atoi(argv[6]));
+    std::string out_dir = argv[7];
+
+    std::atomic<size_t> next_frame;
+    std::atomic<int> failures{0};
+    std::mutex latency_mutex;
+    StageStats latency;
+    // Each of the in_flight lanes takes the next frame until there are none
+    // left.
+    auto lane = [&]() {
+        size_t i;
+        while ((i = next_frame++) < paths.size()) {
+            Clock::time_point start = Clock::now();
+            Buffer<uint16_t> raw = load_and_convert_image(paths[i]);
+            Buffer<uint8_t> output = make_output(raw);
+            if (run_camera_pipe(raw, p, output) != 0) {
+                failures++;
+                continue;
+            }
+            convert_and_save_image(output, output_path(out_dir, paths[i]));
+            std::lock_guard<std::mutex> lock(latency_mutex);
+            latency.samples.push_back(seconds_between(start, Clock::now()));
+        }
+    };
+
+    fprintf(stderr, "%zu frames, %d in flight\n", paths.size(), in_flight);
+    // With HL_WORK_STEALING_POOL set, main has already replaced the Halide
+    // runtime's pool, so there is no baseline to compare against.
+    std::vector<bool> passes = {false, true};
+    if (getenv("HL_WORK_STEALING_POOL")) {
+        fprintf(stderr, "HL_WORK_STEALING_POOL is set; skipping the host threads + Halide pool pass\n");
+        passes = {true};
+    }
+    for (bool use_pool : passes) {
+        next_frame = 0;
+        latency.samples.clear();
+        std::vector<size_t> tasks_run, tasks_stolen;
+        Clock::time_point start = Clock::now();
+        if (use_pool) {
+            WorkStealingPool pool;
+            pool.install();
+            std::vector<std::future<void>> lanes;
+            for (int i = 0; i < in_flight; i++) {
+                lanes.push_back(pool.async(lane));
+            }
+            for (auto &l : lanes) {
+                l.wait();
+            }
+            pool.uninstall();
+            tasks_run = pool.tasks_run();
+            tasks_stolen = pool.tasks_stolen();
+        } else {
+            std::vector<std::thread> lanes;
+            for (int i = 0; i < in_flight; i++) {
+                lanes.emplace_back(lane);
+            }
+            for (auto &l : lanes) {
+                l.join();
+            }
+        }
+        double elapsed = seconds_between(start, Clock::now());
+        fprintf(stderr, "%s: %.2f frames/sec\n",
+                use_pool ? "work-stealing pool" : "host threads + Halide pool",
+                latency.samples.size() / elapsed);
+        latency.report("latency");
+        // How evenly the pool spread the work, and how much of it had to be
+        // stolen to get there.
+        for (size_t i = 0; i < tasks_run.size(); i++) {
+            fprintf(stderr, "  worker %-3zu %8zu tasks  %8zu stolen\n", i, tasks_run[i], tasks_stolen[i]);
+        }
+    }
+    return failures ? -1 : 0;
+}
+
+// Derives a raw of each CFA layout from a GRBG one by dropping its first
+// column and/or row, runs it through camera_pipe_cfa, and checks the result
+// against the GRBG output: dropping a column and reading one column further
+// in moves the image two columns, and likewise for rows.
+int run_cfa(int argc, char **argv) {
+    if (argc < 7) {
+        printf("Usage: ./process --cfa raw.png color_temp gamma contrast sharpen timing_iterations\n"
+               "e.g. ./process --cfa ../images/bayer_small.png 3200 2 50 5 10\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int timing_iterations = atoi(argv[6]);
+    fprintf(stderr, "input: %s (%d x %d), taken as GRBG\n", argv[1], input.width(), input.height());
+
+    const struct {
+        const char *name;
+        int crop_x, crop_y;
+    } layouts[] = {
+        {"grbg", 0, 0},
+        {"rggb", 1, 0},
+        {"bggr", 0, 1},
+        {"gbrg", 1, 1},
+    };
+
+    Buffer<uint8_t> reference = make_output(input);
+    run_camera_pipe(input, p, reference);
+
+    int result = 0;
+    for (const auto &l : layouts) {
+        CfaPattern pattern;
+        parse_cfa_pattern(l.name, &pattern);
+        Buffer<uint16_t> raw = input.cropped(0, l.crop_x, input.width() - 2)
+                                    .cropped(1, l.crop_y, input.height() - 2);
+        raw.set_min(0, 0);
+        Buffer<uint8_t> output = make_output(raw);
+        double best = benchmark(timing_iterations, 1, [&]() {
+            camera_pipe_cfa(pattern, raw, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma,
+                            p.contrast, p.sharpen, p.blackLevel, p.whiteLevel, output);
+        });
+
+        int dx = 2 * l.crop_x, dy = 2 * l.crop_y;
+        int mismatches = 0;
+        output.for_each_element([&](int x, int y, int c) {
+            if (x + dx < reference.width() && y + dy < reference.height()) {
+                mismatches += output(x, y, c) != reference(x + dx, y + dy, c);
+            }
+        });
+        fprintf(stderr, "%s: %gus, %d values differ from grbg\n", l.name, best * 1e6, mismatches);
+        if (mismatches) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// Processes one rectangle of the frame with camera_pipe_roi, reading only
+// the raw it needs, and checks it against the same rectangle of the
+// full-frame camera_pipe output.
+int run_roi(int argc, char **argv) {
+    if (argc < 12) {
+        printf("Usage: ./process --roi raw.png color_temp gamma contrast sharpen timing_iterations x y width height output.png\n"
+               "e.g. ./process --roi ../images/bayer_small.png 3200 2 50 5 10 640 480 256 256 roi.png\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    int timing_iterations = atoi(argv[6]);
+    Roi roi = {atoi(argv[7]), atoi(argv[8]), atoi(argv[9]), atoi(argv[10])};
+
+    Buffer<uint8_t> reference = make_output(input);
+    if (roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 ||
+        roi.x + roi.width > reference.width() || roi.y + roi.height > reference.height()) {
+        fprintf(stderr, "ROI is outside the %d x %d frame\n", reference.width(), reference.height());
+        return -1;
+    }
+
+    Roi raw_region = camera_pipe_roi_raw_region(roi);
+    fprintf(stderr, "ROI %dx%d at %d,%d reads raw %dx%d at %d,%d of %dx%d\n",
+            roi.width, roi.height, roi.x, roi.y,
+            raw_region.width, raw_region.height, raw_region.x, raw_region.y,
+            input.width(), input.height());
+    // Only this much of the raw needs to have been read.
+    Buffer<uint16_t> raw = input.cropped(0, raw_region.x, raw_region.width)
+                                .cropped(1, raw_region.y, raw_region.height);
+    Buffer<uint8_t> output = make_roi_output(roi);
+
+    double full = benchmark(timing_iterations, 1, [&]() {
+        run_camera_pipe(input, p, reference);
+    });
+    double cropped = benchmark(timing_iterations, 1, [&]() {
+        camera_pipe_roi(raw, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                        p.sharpen, p.blackLevel, p.whiteLevel, output);
+    });
+    double area = (double)roi.width * roi.height / ((double)reference.width() * reference.height());
+    fprintf(stderr, "full frame %gus, ROI %gus: %.1f%% of the time for %.1f%% of the area\n",
+            full * 1e6, cropped * 1e6, 100 * cropped / full, 100 * area);
+
+    int mismatches = 0;
+    output.for_each_element([&](int x, int y, int c) {
+        mismatches += output(x, y, c) != reference(x, y, c);
+    });
+    if (mismatches) {
+        fprintf(stderr, "ROI differs from the full frame in %d values\n", mismatches);
+        return -1;
+    }
+
+    // Saved with its min at the origin
+    output.set_min(0, 0, 0);
+    convert_and_save_image(output, argv[11]);
+    return 0;
+}
+
+// Processes frame (a rectangle of the output, via camera_pipe_roi) in bands
+// of band_rows and encodes each band as soon as it's done, as a task on
+// pool, while the next is processed. The bands are joined into one JPEG
+// with restart markers. Each band is its own camera_pipe_roi call, so the
+// stencil halo at every band boundary is computed twice; the time spent in
+// those calls is added to process_time. Returns the end-to-end time, or a
+// negative value on failure.
+double process_and_encode_bands(Buffer<uint16_t> &input, PipeParams &p, const Roi &frame,
+                                int band_rows, const std::string &path, WorkStealingPool &pool,
+                                double *process_time) {
+    Clock::time_point start = Clock::now();
+    JpegStripEncoder encoder(frame.width, frame.height, band_rows);
+    std::vector<std::future<bool>> encoded;
+    bool ok = true;
+    for (int i = 0; i < encoder.num_bands() && ok; i++) {
+        int y = i * band_rows;
+        Roi band_roi = {frame.x, frame.y + y, frame.width, std::min(band_rows, frame.height - y)};
+        Buffer<uint8_t> band = make_roi_output(band_roi);
+        Clock::time_point t = Clock::now();
+        ok = camera_pipe_roi(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                             p.sharpen, p.blackLevel, p.whiteLevel, band) == 0;
+        *process_time += seconds_between(t, Clock::now());
+        if (ok) {
+            encoded.push_back(pool.async([&encoder, band, i]() {
+                return encoder.encode_band(band, i);
+            }));
+        }
+    }
+    // The encodes hold a reference to encoder, so wait for them even if a
+    // band failed.
+    for (auto &e : encoded) {
+        ok = e.get() && ok;
+    }
+    if (!ok || !encoder.write(path)) {
+        return -1;
+    }
+    return seconds_between(start, Clock::now());
+}
+
+// End-to-end latency from raw to encoded file, at 1080p (when the raw is big
+// enough) and for the whole frame: camera_pipe then PNG, as the other modes
+// do; camera_pipe then JPEG as one band; and JPEG bands encoded as they
+// finish. Everything runs on one WorkStealingPool, which takes over
+// camera_pipe's parallel loops as well as running the band encodes, so the
+// encodes don't add threads on top of Halide's.
+int run_jpeg(int argc, char **argv) {
+    if (argc < 8) {
+        printf("Usage: ./process --jpeg raw.png color_temp gamma contrast sharpen band_rows timing_iterations\n"
+               "e.g. ./process --jpeg ../images/bayer_small.png 3200 2 50 5 64 5\n"
+               "Writes jpeg_<width>x<height>.jpg.\n");
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    PipeParams p = make_params(argv + 2);
+    // Restart intervals are whole MCU rows.
+    int band_rows = std::max(16, (atoi(argv[6]) / 16) * 16);
+    int timing_iterations = std::max(1, atoi(argv[7]));
+    Buffer<uint8_t> full = make_output(input);
+    fprintf(stderr, "input: %s (%d x %d), %d row bands\n", argv[1], input.width(), input.height(), band_rows);
+
+    std::vector<Roi> frames;
+    if (full.width() >= 1920 && full.height() >= 1080) {
+        frames.push_back({0, 0, 1920, 1080});
+    } else {
+        fprintf(stderr, "Skipping 1080p: the raw only makes %d x %d\n", full.width(), full.height());
+    }
+    frames.push_back({0, 0, full.width(), full.height()});
+
+    WorkStealingPool pool;
+    pool.install();
+    int result = 0;
+    for (const Roi &frame : frames) {
+        std::string name = "jpeg_" + std::to_string(frame.width) + "x" + std::to_string(frame.height);
+        Buffer<uint8_t> output = make_roi_output(frame);
+        double process = benchmark(timing_iterations, 1, [&]() {
+            camera_pipe_roi(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                            p.sharpen, p.blackLevel, p.whiteLevel, output);
+        });
+        double png = benchmark(timing_iterations, 1, [&]() {
+            camera_pipe_roi(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                            p.sharpen, p.blackLevel, p.whiteLevel, output);
+            convert_and_save_image(output, name + ".png");
+        });
+        double whole = benchmark(timing_iterations, 1, [&]() {
+            camera_pipe_roi(input, p.matrix_3200, p.matrix_7000, p.color_temp, p.gamma, p.contrast,
+                            p.sharpen, p.blackLevel, p.whiteLevel, output);
+            JpegStripEncoder encoder(frame.width, frame.height, frame.height);
+            encoder.encode_band(output, 0);
+            encoder.write(name + "_whole.jpg");
+        });
+        double banded = 1e30, banded_process = 0;
+        for (int i = 0; i < timing_iterations; i++) {
+            double band_process = 0;
+            double t = process_and_encode_bands(input, p, frame, band_rows, name + ".jpg", pool, &band_process);
+            if (t < 0) {
+                fprintf(stderr, "Failed to process and encode %s\n", name.c_str());
+                result = -1;
+                break;
+            }
+            if (t < banded) {
+                banded = t;
+                banded_process = band_process;
+            }
+        }
+        if (result != 0) {
+            break;
+        }
+        fprintf(stderr, "%d x %d: camera_pipe + PNG %.2fms, camera_pipe + JPEG %.2fms, "
+                        "JPEG per band %.2fms\n",
+                frame.width, frame.height, png * 1e3, whole * 1e3, banded * 1e3);
+        // The price of banding: each band's camera_pipe_roi call recomputes
+        // the halo it shares with its neighbors. (The difference also
+        // includes sharing the pool with the encodes of earlier bands.)
+        fprintf(stderr, "  camera_pipe_roi in bands %.2fms vs %.2fms in one call, "
+                        "%.2fms recomputing band halos\n",
+                banded_process * 1e3, process * 1e3, (banded_process - process) * 1e3);
+    }
+    pool.uninstall();
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    WorkStealingPool::install_from_env();
+
+    if (argc > 1 && strcmp(argv[1], "--stream") == 0) {
+        return run_stream(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        return run_batch(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--lut-cache") == 0) {
+        return run_lut_cache(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--strips") == 0) {
+        return run_strips(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--packed") == 0) {
+        return run_packed(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--yuv") == 0) {
+        return run_yuv(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--demosaic") == 0) {
+        return run_demosaic(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--burst") == 0) {
+        return run_burst(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--profile") == 0) {
+        return run_profile(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--memory") == 0) {
+        return run_memory(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--preview") == 0) {
+        return run_preview(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--stats") == 0) {
+        return run_stats(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--arena") == 0) {
+        return run_arena(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--pool") == 0) {
+        return run_pool(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--cfa") == 0) {
+        return run_cfa(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--roi") == 0) {
+        return run_roi(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "--jpeg") == 0) {
+        return run_jpeg(argc - 1, argv + 1);
+    }
+    return run_single(argc, argv);
+}
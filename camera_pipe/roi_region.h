@@ -0,0 +1,44 @@
+#ifndef CAMERA_PIPE_ROI_REGION_H
+#define CAMERA_PIPE_ROI_REGION_H
+
+#include "camera_pipe_roi.h"
+
+#include "HalideBuffer.h"
+
+/**
+ * Region-of-interest processing with the roi build of camera_pipe. An output
+ * buffer whose min is the ROI's origin gets exactly the pixels camera_pipe
+ * would produce there for the whole frame, at a cost proportional to the
+ * ROI's area (plus the fixed cost of the tone curve and color matrix).
+ *
+ * The raw it reads is the ROI plus the stencils' halo, shifted by the fixed
+ * 16, 12 offset and the CFA phase. Rather than hard-coding that here, it's
+ * asked of the pipeline by a bounds query, so it stays right whatever the
+ * generator does.
+ */
+struct Roi {
+    int x, y, width, height;
+};
+
+// An output buffer for roi, with its min at the ROI's origin.
+inline Halide::Runtime::Buffer<uint8_t> make_roi_output(const Roi &roi) {
+    Halide::Runtime::Buffer<uint8_t> output(roi.width, roi.height, 3);
+    output.set_min(roi.x, roi.y, 0);
+    return output;
+}
+
+// The rectangle of the raw needed to process roi.
+inline Roi camera_pipe_roi_raw_region(const Roi &roi) {
+    // Buffers without host memory make the call a bounds query: it only
+    // fills in the regions of the inputs it would read.
+    Halide::Runtime::Buffer<uint16_t> raw(nullptr, 0, 0);
+    Halide::Runtime::Buffer<float> matrix_3200(nullptr, 0, 0), matrix_7000(nullptr, 0, 0);
+    halide_dimension_t shape[] = {{roi.x, roi.width, 1},
+                                  {roi.y, roi.height, roi.width},
+                                  {0, 3, roi.width * roi.height}};
+    Halide::Runtime::Buffer<uint8_t> output(nullptr, 3, shape);
+    camera_pipe_roi(raw, matrix_3200, matrix_7000, 3200, 2, 50, 1, 25, 1023, output);
+    return {raw.dim(0).min(), raw.dim(1).min(), raw.dim(0).extent(), raw.dim(1).extent()};
+}
+
+#endif  // CAMERA_PIPE_ROI_REGION_H
@@ -0,0 +1,125 @@
+// Sweeps the manual camera_pipe schedule's strip_size and tile_width over the
+// grid built by CMakeLists.txt (CAMERA_PIPE_TUNE=ON), and writes the fastest
+// to the tuning config for this machine class, which the camera_pipe build
+// then uses.
+//
+// Every variant runs the same raw with the same parameters, and its time is
+// the best of several samples, so reruns on the same kind of machine agree.
+// The config records the whole table so runs can be compared.
+
+#include "halide_benchmark.h"
+
+#include "HalideBuffer.h"
+#include "halide_image_io.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace Halide::Runtime;
+using namespace Halide::Tools;
+
+namespace {
+
+typedef int (*Pipeline)(halide_buffer_t *, halide_buffer_t *, halide_buffer_t *,
+                        float, float, float, float, int, int, halide_buffer_t *);
+
+struct TuneVariant {
+    int strip_size, tile_width;
+    Pipeline pipeline;
+};
+
+}  // namespace
+
+#include "camera_pipe_tune_variants.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: ./camera_pipe_tune raw.png [samples] [config.cmake]\n"
+               "e.g. ./camera_pipe_tune ../images/bayer_small.png 10\n"
+               "Writes %s by default.\n", CAMERA_PIPE_TUNING_CONFIG);
+        return 0;
+    }
+
+    Buffer<uint16_t> input = load_and_convert_image(argv[1]);
+    int samples = argc > 2 ? atoi(argv[2]) : 10;
+    const char *config_path = argc > 3 ? argv[3] : CAMERA_PIPE_TUNING_CONFIG;
+
+    // The same matrices and settings as the examples in process.cpp.
+    float _matrix_3200[][4] = {{ 1.6697f, -0.2693f, -0.4004f, -42.4346f},
+                                {-0.3576f,  1.0615f,  1.5949f, -37.1158f},
+                                {-0.2175f, -1.8751f,  6.9640f, -26.6970f}};
+
+    float _matrix_7000[][4] = {{ 2.2997f, -0.4478f,  0.1706f, -39.0923f},
+                                {-0.3826f,  1.5906f, -0.2080f, -25.4311f},
+                                {-0.0888f, -0.7344f,  2.2832f, -20.0826f}};
+    Buffer<float> matrix_3200(4, 3), matrix_7000(4, 3);
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            matrix_3200(j, i) = _matrix_3200[i][j];
+            matrix_7000(j, i) = _matrix_7000[i][j];
+        }
+    }
+    const float color_temp = 3200, gamma = 2, contrast = 50, sharpen = 5;
+    const int blackLevel = 25, whiteLevel = 1023;
+
+    // Sized like process.cpp's output.
+    int width = ((input.width() - 32)/32)*32, height = ((input.height() - 24)/32)*32;
+    Buffer<uint8_t> reference(width, height, 3), output(width, height, 3);
+
+    const int num_variants = sizeof(tune_variants) / sizeof(tune_variants[0]);
+    std::vector<double> times(num_variants);
+    int best = 0;
+    fprintf(stderr, "input: %s (%d x %d), %d threads, %d samples per variant\n",
+            argv[1], input.width(), input.height(), (int)std::thread::hardware_concurrency(), samples);
+    fprintf(stderr, "  strip_size tile_width         ms\n");
+    for (int i = 0; i < num_variants; i++) {
+        const TuneVariant &v = tune_variants[i];
+        Buffer<uint8_t> &result = i == 0 ? reference : output;
+        times[i] = benchmark(samples, 1, [&]() {
+            v.pipeline(input, matrix_3200, matrix_7000, color_temp, gamma, contrast,
+                       sharpen, blackLevel, whiteLevel, result);
+        });
+        fprintf(stderr, "  %10d %10d %10.3f\n", v.strip_size, v.tile_width, times[i] * 1e3);
+
+        // The schedule must never change the result.
+        if (i > 0) {
+            int mismatches = 0;
+            output.for_each_element([&](int x, int y, int c) {
+                mismatches += output(x, y, c) != reference(x, y, c);
+            });
+            if (mismatches) {
+                fprintf(stderr, "strip_size %d tile_width %d differs from the first variant in %d values\n",
+                        v.strip_size, v.tile_width, mismatches);
+                return -1;
+            }
+        }
+        if (times[i] < times[best]) {
+            best = i;
+        }
+    }
+
+    FILE *f = fopen(config_path, "w");
+    if (!f) {
+        fprintf(stderr, "Could not open %s\n", config_path);
+        return -1;
+    }
+    fprintf(f, "# camera_pipe schedule for machine class %s, written by camera_pipe_tune.\n"
+               "# %s (%d x %d), %d threads, best of %d samples per variant:\n"
+               "#   strip_size tile_width         ms\n",
+            CAMERA_PIPE_MACHINE_CLASS, argv[1], input.width(), input.height(),
+            (int)std::thread::hardware_concurrency(), samples);
+    for (int i = 0; i < num_variants; i++) {
+        fprintf(f, "#   %10d %10d %10.3f\n", tune_variants[i].strip_size, tune_variants[i].tile_width,
+                times[i] * 1e3);
+    }
+    fprintf(f, "set(CAMERA_PIPE_STRIP_SIZE %d)\nset(CAMERA_PIPE_TILE_WIDTH %d)\n",
+            tune_variants[best].strip_size, tune_variants[best].tile_width);
+    fclose(f);
+
+    fprintf(stderr, "Best: strip_size %d tile_width %d (%.3fms), written to %s\n",
+            tune_variants[best].strip_size, tune_variants[best].tile_width, times[best] * 1e3, config_path);
+    return 0;
+}
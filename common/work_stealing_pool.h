@@ -0,0 +1,335 @@
+#ifndef HALIDE_PLAYGROUND_WORK_STEALING_POOL_H
+#define HALIDE_PLAYGROUND_WORK_STEALING_POOL_H
+
+#include "HalideRuntime.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ * A thread pool shared by the Halide runtime and the host code around it,
+ * so a driver with its own loader and encoder threads doesn't end up with
+ * one Halide worker per core plus those threads all competing for the cores.
+ *
+ * Each worker has its own deque of tasks. Tasks a worker submits go on the
+ * back of its own deque and it takes from the back, so nested work stays on
+ * the core that made it; an idle worker steals from the front of the
+ * others'. Tasks submitted from outside the pool are dealt round-robin.
+ * Worker i is pinned to the i-th of the cores the process may run on.
+ *
+ * install() routes Halide's parallel loops here through the custom
+ * do_par_for and do_task hooks. A parallel loop is run by the calling thread
+ * together with as many helper tasks as there are workers, all claiming
+ * iterations from a shared counter. The calling thread claims iterations
+ * until none are left, so it only ever waits for iterations already running
+ * on other threads, and parallel loops nested in tasks (or in other parallel
+ * loops) can't deadlock the pool. While it waits it sleeps rather than
+ * picking up unrelated tasks, which could hold the loop up for as long as
+ * they run.
+ */
+class WorkStealingPool {
+public:
+    typedef std::function<void()> Task;
+
+    // num_threads <= 0 means one worker per core the process may run on.
+    explicit WorkStealingPool(int num_threads = 0, bool pin_threads = true) {
+        std::vector<int> cores = allowed_cores();
+        int n = num_threads > 0 ? num_threads : (int)cores.size();
+        for (int i = 0; i < n; i++) {
+            workers.emplace_back(new Worker);
+        }
+        for (int i = 0; i < n; i++) {
+            int core = cores[i % cores.size()];
+            workers[i]->thread = std::thread([this, i, pin_threads, core]() {
+                if (pin_threads) {
+                    pin_to_core(core);
+                }
+                worker_loop(i);
+            });
+        }
+    }
+
+    ~WorkStealingPool() {
+        if (installed() == this) {
+            uninstall();
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &w : workers) {
+            w->thread.join();
+        }
+    }
+
+    int size() const {
+        return (int)workers.size();
+    }
+
+    void submit(Task task) {
+        int self = current_worker();
+        Worker &w = *workers[self >= 0 ? self : next_worker++ % workers.size()];
+        // Counted before it can be taken, so run_one never sees pending
+        // drop below the number of queued tasks.
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            pending++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(w.mutex);
+            w.tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    // submit() for host code that wants the result.
+    template<typename F>
+    std::future<decltype(std::declval<F>()())> async(F f) {
+        typedef decltype(f()) R;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+        submit([task]() { (*task)(); });
+        return task->get_future();
+    }
+
+    // Runs body(i) for i in [min, min + extent), returning once all have
+    // finished. Returns the first non-zero result of body, or zero.
+    int parallel_for(int min, int extent, const std::function<int(int)> &body) {
+        if (extent <= 0) {
+            return 0;
+        }
+        struct Loop {
+            std::atomic<int> next{0}, done{0}, error{0};
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        std::shared_ptr<Loop> loop = std::make_shared<Loop>();
+        // Helpers that start after every iteration is claimed return without
+        // touching body, so it's safe to hold it by reference.
+        auto run = [loop, min, extent, &body]() {
+            int i;
+            while ((i = loop->next++) < extent) {
+                int result = body(min + i);
+                if (result != 0) {
+                    int expected = 0;
+                    loop->error.compare_exchange_strong(expected, result);
+                }
+                if (++loop->done == extent) {
+                    std::lock_guard<std::mutex> lock(loop->mutex);
+                    loop->finished.notify_all();
+                }
+            }
+        };
+
+        int helpers = std::min(extent - 1, size());
+        for (int i = 0; i < helpers; i++) {
+            submit(run);
+        }
+        // Returns once every iteration has been claimed; the rest are
+        // running on other threads.
+        run();
+
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        loop->finished.wait(lock, [&]() { return loop->done == extent; });
+        return loop->error;
+    }
+
+    // Replaces the Halide runtime's thread pool (or the pool installed
+    // before) with this one, until uninstall().
+    void install() {
+        previous_pool = installed();
+        installed() = this;
+        previous_do_par_for = halide_set_custom_do_par_for(halide_do_par_for_hook);
+        previous_do_task = halide_set_custom_do_task(halide_do_task_hook);
+    }
+
+    void uninstall() {
+        halide_set_custom_do_par_for(previous_do_par_for);
+        halide_set_custom_do_task(previous_do_task);
+        installed() = previous_pool;
+    }
+
+    // If HL_WORK_STEALING_POOL is set, installs a pool with that many
+    // workers (0 for one per core) for the rest of the process, so any
+    // driver can opt in without changing its code. Returns it, or nullptr.
+    static WorkStealingPool *install_from_env() {
+        const char *threads = getenv("HL_WORK_STEALING_POOL");
+        if (!threads) {
+            return nullptr;
+        }
+        static std::unique_ptr<WorkStealingPool> pool(new WorkStealingPool(atoi(threads)));
+        pool->install();
+        return pool.get();
+    }
+
+    // Tasks each worker has run, and how many of those it stole.
+    std::vector<size_t> tasks_run() const {
+        std::vector<size_t> result;
+        for (const auto &w : workers) {
+            result.push_back(w->tasks_run);
+        }
+        return result;
+    }
+
+    std::vector<size_t> tasks_stolen() const {
+        std::vector<size_t> result;
+        for (const auto &w : workers) {
+            result.push_back(w->tasks_stolen);
+        }
+        return result;
+    }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+        std::atomic<size_t> tasks_run{0}, tasks_stolen{0};
+    };
+
+    static WorkStealingPool *&installed() {
+        static WorkStealingPool *pool = nullptr;
+        return pool;
+    }
+
+    static int halide_do_par_for_hook(void *user_context, halide_task_t f, int min, int extent, uint8_t *closure) {
+        return installed()->parallel_for(min, extent, [=](int i) {
+            return halide_do_task(user_context, f, i, closure);
+        });
+    }
+
+    static int halide_do_task_hook(void *user_context, halide_task_t f, int idx, uint8_t *closure) {
+        return f(user_context, idx, closure);
+    }
+
+    // The cores in the process's affinity mask (which taskset or a cgroup
+    // cpuset may have narrowed), in order. Where that can't be read, the
+    // first hardware_concurrency() cores.
+    static std::vector<int> allowed_cores() {
+        std::vector<int> cores;
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+            for (int i = 0; i < CPU_SETSIZE; i++) {
+                if (CPU_ISSET(i, &cpus)) {
+                    cores.push_back(i);
+                }
+            }
+        }
+#endif
+        if (cores.empty()) {
+            int n = std::max(1, (int)std::thread::hardware_concurrency());
+            for (int i = 0; i < n; i++) {
+                cores.push_back(i);
+            }
+        }
+        return cores;
+    }
+
+    static void pin_to_core(int core) {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+    }
+
+    // The index of the calling thread in this pool, or -1 if it isn't one
+    // of its workers.
+    int current_worker() const {
+        return worker_pool() == this ? worker_index() : -1;
+    }
+
+    static const WorkStealingPool *&worker_pool() {
+        static thread_local const WorkStealingPool *pool = nullptr;
+        return pool;
+    }
+
+    static int &worker_index() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    // Runs one task: the newest of worker self's own, or else the oldest of
+    // some other worker's. Returns false if every deque was empty.
+    bool run_one(int self) {
+        Task task;
+        bool stolen = false;
+        if (self >= 0) {
+            Worker &w = *workers[self];
+            std::lock_guard<std::mutex> lock(w.mutex);
+            if (!w.tasks.empty()) {
+                task = std::move(w.tasks.back());
+                w.tasks.pop_back();
+            }
+        }
+        for (size_t i = 1; !task && i <= workers.size(); i++) {
+            Worker &victim = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                stolen = true;
+            }
+        }
+        if (!task) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            pending--;
+        }
+        if (self >= 0) {
+            workers[self]->tasks_run++;
+            workers[self]->tasks_stolen += stolen;
+        }
+        task();
+        return true;
+    }
+
+    void worker_loop(int i) {
+        worker_pool() = this;
+        worker_index() = i;
+        while (true) {
+            if (run_one(i)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [&]() { return stopping || pending > 0; });
+            if (stopping && pending == 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next_worker{0};
+
+    // Tasks submitted but not yet started; idle workers sleep while it's 0.
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    size_t pending = 0;
+    bool stopping = false;
+
+    WorkStealingPool *previous_pool = nullptr;
+    halide_do_par_for_t previous_do_par_for = nullptr;
+    halide_do_task_t previous_do_task = nullptr;
+};
+
+#endif  // HALIDE_PLAYGROUND_WORK_STEALING_POOL_H
@@ -12,32 +12,60 @@ using namespace Halide::ConciseCasts;
 Var x("x"), y("y"), z("z"), c("c");
 Var xo("xo"), yo("yo"), xi("xi"), yi("yi");
 
+// How GaussianPipe treats the edges. With none, the output is 8 pixels
+// smaller than the input in each dimension; otherwise it is the same size,
+// and pixels beyond the edges repeat the edge pixel, or mirror the ones
+// inside it (without repeating the edge pixel).
+enum class Boundary { None, RepeatEdge, Mirror };
+
+const std::map<std::string, Boundary> boundaries = {
+    {"none", Boundary::None},
+    {"repeat_edge", Boundary::RepeatEdge},
+    {"mirror", Boundary::Mirror},
+};
+
+// The 9 tap, sigma 1.5 kernel of GaussianPipe, and of the variants that
+// match its output.
+Func gaussian_pipe_kernel()
+{
+    Func kernel("kernel"), kernel_f("kernel_f");
+    float sigma = 1.5f;
+
+    kernel_f(x) = exp(-x * x / (2 * sigma * sigma)) / (sqrtf(2 * M_PI) * sigma);
+
+    // Normalize and convert to 8bit fixed point.
+    // Kernel values will inlined into  the blurring kernel as constant
+    kernel(x) = cast<uint8_t>(kernel_f(x) * 255 /
+                              (kernel_f(0) + kernel_f(1) * 2 + kernel_f(2) * 2 +
+                               kernel_f(3) * 2 + kernel_f(4) * 2));
+    return kernel;
+}
+
 class GaussianPipe : public Halide::Generator<GaussianPipe>
 {
   public:
+    GeneratorParam<Boundary> boundary{"boundary", Boundary::None, boundaries};
+
     Input<Buffer<uint8_t>> input{"input", 2};
     Output<Buffer<uint8_t>> output{"output"};
 
     void generate()
     {
 
-        Func in_bounded("in_bounded"), kernel("kernel"), kernel_f("kernel_f"),
-            sum_x("sum_x"), sum_y("sum_y"), blur_y("blur_y"), blur_x("blur_x");
+        Func in_bounded("in_bounded"), sum_x("sum_x"), sum_y("sum_y"),
+            blur_y("blur_y"), blur_x("blur_x");
         RDom win(0, 2), win2(-4, 9, -4, 9);
         // Define a 9x9 Gaussian Blur with a
         // repeat-edge boundary condition.
-        float sigma = 1.5f;
-
-        kernel_f(x) = exp(-x * x / (2 * sigma * sigma)) / (sqrtf(2 * M_PI) * sigma);
+        Func kernel = gaussian_pipe_kernel();
 
-        // Normalize and convert to 8bit fixed point.
-        // Kernel values will inlined into  the blurring kernel as constant
-        kernel(x) = cast<uint8_t>(kernel_f(x) * 255 /
-                                  (kernel_f(0) + kernel_f(1) * 2 + kernel_f(2) * 2 +
-                                   kernel_f(3) * 2 + kernel_f(4) * 2));
-
-        // in_bounded = BoundaryConditions::repeat_edge(in);
-        in_bounded(x, y) = input(x + 4, y + 4);
+        if (boundary == Boundary::RepeatEdge) {
+            in_bounded = BoundaryConditions::repeat_edge(input);
+        } else if (boundary == Boundary::Mirror) {
+            in_bounded = BoundaryConditions::mirror_interior(input);
+        } else {
+            in_bounded(x, y) = input(x + 4, y + 4);
+        }
 
         // 2D filter: direct map
         sum_x(x, y) += cast<uint32_t>(in_bounded(x + win2.x, y + win2.y)) *
@@ -47,11 +75,374 @@ class GaussianPipe : public Halide::Generator<GaussianPipe>
         sum_x.update(0).unroll(win2.x).unroll(win2.y);
 
         output(x, y) = blur_x(x, y);
+        if (boundary == Boundary::None) {
+            output.tile(x, y, xo, yo, xi, yi, 256, 64)
+                .vectorize(xi, 8)
+                .fuse(xo, yo, xo)
+                .parallel(xo);
+        } else {
+            // Each tile first copies its input, halo included, so the 81
+            // taps always load contiguous vectors. The boundary conditions
+            // mark the clamped coordinates as likely to be in range, and
+            // Halide partitions the tile loops on that: tiles clear of the
+            // edges get a copy of the loop with the clamps simplified away.
+            // That only works on the separate x and y tile loops, so the
+            // tiles aren't fused. Frames may be smaller than a tile (the
+            // upper levels of a pyramid, say), so partial tiles are
+            // guarded rather than shifted inwards.
+            output.tile(x, y, xo, yo, xi, yi, 256, 64, TailStrategy::GuardWithIf)
+                .vectorize(xi, 8)
+                .parallel(yo);
+            in_bounded.compute_at(output, xo)
+                .vectorize(x, 16);
+        }
+    }
+}; // namespace
+
+// GaussianPipe on interleaved (x, y, c) RGB or RGBA frames, with each
+// channel blurred with the same 9x9 kernel, so a frame doesn't need to be
+// split into planes and blurred one plane at a time.
+//
+// The channel loop is innermost and unrolled inside the vectorized x loop.
+// The channels of a tap then load from one dense span of the input,
+// deinterleaved by shuffles, and the output channels are interleaved back
+// into dense vector stores.
+class GaussianInterleaved : public Halide::Generator<GaussianInterleaved>
+{
+  public:
+    GeneratorParam<int> channels{"channels", 3, 3, 4};
+
+    Input<Buffer<uint8_t>> input{"input", 3};
+    Output<Buffer<uint8_t>> output{"output", 3};
+
+    void generate()
+    {
+        Func in_bounded("in_bounded"), sum_x("sum_x");
+        RDom win2(-4, 9, -4, 9);
+        Func kernel = gaussian_pipe_kernel();
+
+        in_bounded(x, y, c) = input(x + 4, y + 4, c);
+
+        sum_x(x, y, c) += cast<uint32_t>(in_bounded(x + win2.x, y + win2.y, c)) *
+                          kernel(win2.x) * kernel(win2.y);
+
+        output(x, y, c) = cast<uint8_t>(sum_x(x, y, c) >> 16);
+
+        input.dim(0).set_stride(channels);
+        input.dim(2).set_min(0).set_extent(channels).set_stride(1);
+        output.dim(0).set_stride(channels);
+        output.dim(2).set_min(0).set_extent(channels).set_stride(1);
+
+        const int vec = natural_vector_size<uint8_t>();
+        output.tile(x, y, xo, yo, xi, yi, 128, 32)
+            .reorder(c, xi, yi, xo, yo)
+            .bound(c, 0, channels)
+            .unroll(c)
+            .vectorize(xi, vec)
+            .fuse(xo, yo, xo)
+            .parallel(xo);
+        sum_x.compute_at(output, yi)
+            .reorder(c, x, y)
+            .unroll(c)
+            .vectorize(x, vec);
+        sum_x.update()
+            .reorder(c, win2.x, win2.y, x, y)
+            .unroll(c)
+            .unroll(win2.x)
+            .unroll(win2.y)
+            .vectorize(x, vec);
+    }
+};
+
+// A Gaussian pyramid built with GaussianPipe's kernel. pyramid[i] is level
+// i + 1, each level being the one before blurred and decimated by 2 in each
+// dimension, with level 0 the input. Level k is ceil(width / 2^k) by
+// ceil(height / 2^k), and edges repeat as in gaussian_pipe_repeat_edge.
+//
+// Every level is computed from the previous one in the same call. Each
+// level blurs only the rows and columns it keeps, separably, with the
+// vertical sums unrounded, so it matches blurring the level before with
+// gaussian_pipe_repeat_edge and taking every other pixel. Levels of at
+// least parallel_pixels pixels run their strips of rows in parallel; the
+// rest are too small to be worth waking the thread pool for.
+class GaussianPyramid : public Halide::Generator<GaussianPyramid>
+{
+  public:
+    GeneratorParam<int> levels{"levels", 8, 1, 16};
+    GeneratorParam<int> parallel_pixels{"parallel_pixels", 256 * 256};
+
+    Input<Buffer<uint8_t>> input{"input", 2};
+    Output<Func[]> pyramid{"pyramid", UInt(8), 2};
+
+    void generate()
+    {
+        const int n = levels, min_parallel = parallel_pixels;
+        pyramid.resize(n);
+
+        Func kernel = gaussian_pipe_kernel();
+        kernel.compute_root();
+        RDom r(-4, 9);
+
+        Func prev = input;
+        Expr width = input.width(), height = input.height();
+        const int vec = natural_vector_size<uint8_t>();
+        for (int k = 0; k < n; k++) {
+            std::string level = std::to_string(k + 1);
+            Func clamped = BoundaryConditions::repeat_edge(prev, {{0, width}, {0, height}});
+            Func blur_y("blur_y_" + level), blur_x("blur_x_" + level);
+
+            // The taps sum to at most 255, so the columns fit in 16 bits.
+            blur_y(x, y) += cast<uint16_t>(clamped(x, 2 * y + r)) * kernel(r);
+            blur_x(x, y) += cast<uint32_t>(blur_y(2 * x + r, y)) * kernel(r);
+            pyramid[k](x, y) = cast<uint8_t>(blur_x(x, y) >> 16);
+
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+
+            // Small levels can be narrower than a vector or shorter than a
+            // strip.
+            pyramid[k].split(y, yo, yi, 8, TailStrategy::GuardWithIf)
+                .vectorize(x, vec, TailStrategy::GuardWithIf);
+            blur_y.compute_at(pyramid[k], yo).vectorize(x, vec);
+            blur_y.update().vectorize(x, vec).unroll(r);
+            blur_x.compute_at(pyramid[k], yi).vectorize(x, vec);
+            blur_x.update().vectorize(x, vec).unroll(r);
+            pyramid[k].specialize(width * height >= min_parallel).parallel(yo);
+
+            prev = pyramid[k];
+        }
+    }
+};
+
+// Approximate Gaussian blur for large radii: three box filters of the given
+// radius down the columns and then three along the rows, which is close to
+// a Gaussian of sigma sqrt(radius * (radius + 1)). Each box is a running
+// sum, updated by one pixel entering the window and one leaving it, so its
+// cost per pixel doesn't depend on the radius.
+//
+// The output is the same size as the input, with repeat-edge boundaries.
+// Between boxes the values are kept in 8.8 fixed point, the sums in 32 bits
+// and each box is normalized with a rounding integer division, so nothing
+// is lost to float precision or drifts along a column, at any radius.
+class GaussianBox : public Halide::Generator<GaussianBox>
+{
+  public:
+    Input<Buffer<uint8_t>> input{"input", 2};
+    Input<int> radius{"radius", 8, 1, 1000};
+    Output<Buffer<uint8_t>> output{"output", 2};
+
+    void generate()
+    {
+        Func in_fixed("in_fixed");
+        in_fixed(x, y) = cast<uint16_t>(input(x, y)) << 8;
+
+        // As in GaussianIir, the column passes vectorize across x, and
+        // write their result transposed so the second set runs along the
+        // rows.
+        Func box_y = box_cols_transpose(in_fixed, input.height(), "box_y");
+        Func box_x = box_cols_transpose(box_y, input.width(), "box_x");
+
+        output(x, y) = cast<uint8_t>((box_x(x, y) + 128) >> 8);
+
+        output.vectorize(x, natural_vector_size<uint8_t>())
+            .parallel(y, 8);
+    }
+
+  private:
+    Func box_cols_transpose(Func in, Expr height, std::string name)
+    {
+        Expr r = radius;
+        Expr n = cast<uint32_t>(2 * r + 1);
+        RDom window(-r, 2 * r + 1), ry(1, height - 1);
+
+        Func transpose(name);
+        std::vector<Func> sums;
+        Func box = in;
+        for (int pass = 0; pass < 3; pass++) {
+            Func clamped, sum(name + "_sum_" + std::to_string(pass));
+            clamped(x, y) = cast<uint32_t>(box(x, clamp(y, 0, height - 1)));
+
+            // The first row's window is summed in full, and each row after
+            // it adds the pixel entering the window and drops the one
+            // leaving it.
+            sum(x, y) = cast<uint32_t>(0);
+            sum(x, 0) += clamped(x, window);
+            sum(x, ry) = sum(x, ry - 1) + clamped(x, ry + r) - clamped(x, ry - r - 1);
+
+            box = Func(name + "_" + std::to_string(pass));
+            box(x, y) = cast<uint16_t>((sum(x, y) + n / 2) / n);
+            sums.push_back(sum);
+        }
+        transpose(x, y) = box(y, x);
+
+        // Each row of transposed tiles is a strip of columns, which runs
+        // its three scans with x vectorized, and the strips in parallel.
+        const int vec = natural_vector_size<uint16_t>();
+        transpose.compute_root()
+            .tile(x, y, xo, yo, x, y, vec, vec * 4)
+            .split(y, y, yi, vec)
+            .unroll(yi)
+            .vectorize(x)
+            .parallel(yo);
+        for (Func sum : sums) {
+            sum.compute_at(transpose, yo)
+                .vectorize(x, vec);
+            sum.update(0).vectorize(x, vec);
+            sum.update(1).reorder(x, ry).vectorize(x, vec);
+        }
+        return transpose;
+    }
+};
+
+// Separable version of GaussianPipe with sigma and radius chosen at run
+// time. The 9x9 direct stencil does 81 multiply-adds per pixel; blurring
+// the columns and then the rows does 2 * (2 * radius + 1). The kernel is
+// the same 8 bit fixed point one, and the vertical pass keeps its 16 bit
+// sums unrounded, so for sigma 1.5 and radius 4 the output matches
+// gaussian_pipe's.
+//
+// Like gaussian_pipe, the output is not padded: output(x, y) is centered on
+// input(x + radius, y + radius), so it is 2 * radius smaller than the input.
+class GaussianSeparable : public Halide::Generator<GaussianSeparable>
+{
+  public:
+    Input<Buffer<uint8_t>> input{"input", 2};
+    Input<float> sigma{"sigma", 1.5f, 0.1f, 16.0f};
+    Input<int> radius{"radius", 4, 1, 32};
+    Output<Buffer<uint8_t>> output{"output", 2};
+
+    void generate()
+    {
+        Func in_bounded("in_bounded"), kernel("kernel"), kernel_f("kernel_f"),
+            kernel_sum("kernel_sum"), sum_x("sum_x"), sum_y("sum_y");
+        Expr s = sigma, rad = radius;
+        RDom r(-rad, 2 * rad + 1);
+
+        kernel_f(x) = exp(-x * x / (2 * s * s)) / (sqrt(2 * float(M_PI)) * s);
+        kernel_sum() = 0.0f;
+        kernel_sum() += kernel_f(r);
+
+        // Normalize and convert to 8bit fixed point, as in GaussianPipe.
+        kernel(x) = cast<uint8_t>(kernel_f(x) * 255 / kernel_sum());
+
+        in_bounded(x, y) = input(x + rad, y + rad);
+
+        // The taps sum to at most 255, so the columns fit in 16 bits.
+        sum_y(x, y) = cast<uint16_t>(0);
+        sum_y(x, y) += cast<uint16_t>(in_bounded(x, y + r)) * kernel(r);
+        sum_x(x, y) = cast<uint32_t>(0);
+        sum_x(x, y) += cast<uint32_t>(sum_y(x + r, y)) * kernel(r);
+
+        output(x, y) = cast<uint8_t>(sum_x(x, y) >> 16);
+
+        kernel_sum.compute_root();
+        kernel.compute_root();
+
         output.tile(x, y, xo, yo, xi, yi, 256, 64)
-            .vectorize(xi, 8)
+            .vectorize(xi, 16)
             .fuse(xo, yo, xo)
             .parallel(xo);
+        for (Func f : {sum_y, sum_x}) {
+            f.compute_at(output, xo).vectorize(x, 16);
+            f.update().vectorize(x, 16);
+            // A specialization starts from the schedule so far; with the
+            // radius known the taps can be unrolled and their weights
+            // kept in registers. Larger radii loop over the taps.
+            for (int k = 1; k <= 4; k++) {
+                f.update().specialize(rad == k).unroll(r);
+            }
+        }
     }
-}; // namespace
+};
+
+// Recursive (IIR) Gaussian of Young and van Vliet: a third order causal
+// filter followed by the same filter run backwards, applied down the columns
+// and then along the rows. It costs the same per pixel for any sigma, so it
+// is the one to use for sigma of 10 or more, where the FIR kernels need
+// dozens of taps. It is an approximation, which at small sigma stays within
+// about a level on average of the FIR blurs.
+//
+// Unlike gaussian_pipe, the output is the same size as the input, with
+// repeat-edge boundaries: the recursions start from the edge pixels'
+// steady state.
+class GaussianIir : public Halide::Generator<GaussianIir>
+{
+  public:
+    Input<Buffer<uint8_t>> input{"input", 2};
+    Input<float> sigma{"sigma", 10.0f, 0.5f, 1000.0f};
+    Output<Buffer<uint8_t>> output{"output", 2};
+
+    void generate()
+    {
+        // Filter coefficients, from Young and van Vliet, "Recursive
+        // implementation of the Gaussian filter", Signal Processing 44, 1995.
+        Expr s = sigma;
+        Expr q = select(s >= 2.5f, 0.98711f * s - 0.96330f,
+                        3.97156f - 4.14554f * sqrt(1 - 0.26891f * s));
+        Expr q2 = q * q, q3 = q2 * q;
+        Expr b0 = 1.57825f + 2.44413f * q + 1.4281f * q2 + 0.422205f * q3;
+        a1 = (2.44413f * q + 2.85619f * q2 + 1.26661f * q3) / b0;
+        a2 = -(1.4281f * q2 + 1.26661f * q3) / b0;
+        a3 = 0.422205f * q3 / b0;
+        b = 1 - (a1 + a2 + a3);
+
+        Func in_f("in_f");
+        in_f(x, y) = cast<float>(input(x, y));
+
+        // Each pass blurs columns, which vectorizes across x, and writes
+        // its result transposed, so the second pass blurs the rows and
+        // transposes them back.
+        Func blur_y = blur_cols_transpose(in_f, input.height(), "blur_y");
+        Func blur_x = blur_cols_transpose(blur_y, input.width(), "blur_x");
+
+        output(x, y) = cast<uint8_t>(clamp(blur_x(x, y) + 0.5f, 0.0f, 255.0f));
+
+        output.vectorize(x, natural_vector_size<uint8_t>())
+            .parallel(y, 8);
+    }
+
+  private:
+    Expr a1, a2, a3, b;
+
+    Func blur_cols_transpose(Func in, Expr height, std::string name)
+    {
+        Func blur(name + "_cols"), transpose(name);
+        RDom ry(0, height), tail(0, 3);
+
+        // Rows -3 to -1 hold the top row, the causal filter's steady state.
+        blur(x, y) = in(x, clamp(y, 0, height - 1));
+        blur(x, ry) = b * blur(x, ry) + a1 * blur(x, ry - 1) +
+                      a2 * blur(x, ry - 2) + a3 * blur(x, ry - 3);
+        // Likewise for the anticausal filter below the bottom row.
+        blur(x, height + tail) = blur(x, height - 1);
+        Expr flip = height - 1 - ry;
+        blur(x, flip) = b * blur(x, flip) + a1 * blur(x, flip + 1) +
+                        a2 * blur(x, flip + 2) + a3 * blur(x, flip + 3);
+
+        transpose(x, y) = blur(y, x);
+
+        // Each row of transposed tiles is a strip of columns of blur, which
+        // is filtered with x vectorized and the strips in parallel. The
+        // tiles are square blocks of vectors, transposed in registers.
+        const int vec = natural_vector_size<float>();
+        transpose.compute_root()
+            .tile(x, y, xo, yo, x, y, vec, vec * 4)
+            .split(y, y, yi, vec)
+            .unroll(yi)
+            .vectorize(x)
+            .parallel(yo);
+        blur.compute_at(transpose, yo)
+            .vectorize(x);
+        blur.update(0).reorder(x, ry).vectorize(x);
+        blur.update(1).vectorize(x);
+        blur.update(2).reorder(x, ry).vectorize(x);
+        return transpose;
+    }
+};
 } // namespace
-HALIDE_REGISTER_GENERATOR(GaussianPipe, gaussian_pipe)
\ No newline at end of file
+HALIDE_REGISTER_GENERATOR(GaussianPipe, gaussian_pipe)
+HALIDE_REGISTER_GENERATOR(GaussianSeparable, gaussian_separable)
+HALIDE_REGISTER_GENERATOR(GaussianIir, gaussian_iir)
+HALIDE_REGISTER_GENERATOR(GaussianInterleaved, gaussian_interleaved)
+HALIDE_REGISTER_GENERATOR(GaussianPyramid, gaussian_pyramid)
+HALIDE_REGISTER_GENERATOR(GaussianBox, gaussian_box)
\ No newline at end of file
@@ -1,21 +1,571 @@
 #include "halide_benchmark.h"
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <math.h>
+#include <thread>
+#include <vector>
 
+#include "gaussian_box.h"
+#include "gaussian_iir.h"
 #include "gaussian_pipe.h"
+#include "gaussian_pipe_mirror.h"
+#include "gaussian_pipe_repeat_edge.h"
+#include "gaussian_pyramid.h"
+#include "gaussian_rgb.h"
+#include "gaussian_rgba.h"
+#include "gaussian_separable.h"
 
 #include "HalideBuffer.h"
 #include "halide_image_io.h"
+#include "work_stealing_pool.h"
 
 using Halide::Runtime::Buffer;
 using namespace Halide::Tools;
 
-int main(int argc, char **argv) {
+// Number of pixels where a differs from b offset by (dx, dy), over a's
+// extent.
+int count_mismatches(const Buffer<uint8_t> &a, const Buffer<uint8_t> &b, int dx = 0, int dy = 0) {
+  int mismatches = 0;
+  a.for_each_element([&](int x, int y) {
+    if (a(x, y) != b(x + dx, y + dy)) {
+      mismatches++;
+    }
+  });
+  return mismatches;
+}
+
+double megapixels_per_second(const Buffer<uint8_t> &out, double seconds) {
+  return out.width() * out.height() / seconds / 1e6;
+}
+
+// Times the separable, run-time sigma blur against the direct 9x9 one, and
+// checks that with gaussian_pipe's sigma and radius they agree.
+int run_separable(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: ./run --separable in.png [iterations]\n");
+    return 0;
+  }
+
+  Buffer<uint8_t> input = load_image(argv[1]);
+  int timing_iterations = argc > 2 ? atoi(argv[2]) : 10;
+  printf("input: %s %d %d\n", argv[1], input.width(), input.height());
+
+  Buffer<uint8_t> direct(input.width() - 8, input.height() - 8);
+  double best = benchmark(timing_iterations, 1, [&]() {
+    gaussian_pipe(input, direct);
+  });
+  printf("direct 9x9:\t\t%gms\t%.1f MP/s\n", best * 1e3, megapixels_per_second(direct, best));
+
+  Buffer<uint8_t> separable(direct.width(), direct.height());
+  gaussian_separable(input, 1.5f, 4, separable);
+  int mismatches = count_mismatches(direct, separable);
+  printf("separable (sigma 1.5, radius 4) differs from direct at %d pixels\n", mismatches);
+
+  // Radii 1 to 4 run the unrolled specializations; the others the loop
+  // over taps. sigma is scaled with the radius as in gaussian_pipe.
+  for (int radius : {1, 2, 3, 4, 6, 8, 12}) {
+    float sigma = radius * 0.375f;
+    Buffer<uint8_t> out(input.width() - 2 * radius, input.height() - 2 * radius);
+    best = benchmark(timing_iterations, 1, [&]() {
+      gaussian_separable(input, sigma, radius, out);
+    });
+    printf("separable radius %d:\t%gms\t%.1f MP/s\n", radius, best * 1e3, megapixels_per_second(out, best));
+  }
+
+  return mismatches == 0 ? 0 : -1;
+}
+
+// The 8 bit taps of the FIR kernels, computed as the generators do.
+std::vector<uint8_t> fixed_point_kernel(float sigma, int radius) {
+  std::vector<float> k;
+  float total = 0;
+  for (int i = -radius; i <= radius; i++) {
+    k.push_back(expf(-i * i / (2 * sigma * sigma)) / (sqrtf(2 * M_PI) * sigma));
+    total += k.back();
+  }
+  std::vector<uint8_t> taps;
+  for (float ki : k) {
+    taps.push_back((uint8_t)(ki * 255 / total));
+  }
+  return taps;
+}
+
+// Sum of the taps. Truncating each tap loses a little, so a FIR blur's gain
+// is (sum / 255)^2 rather than 1.
+int fixed_point_kernel_sum(float sigma, int radius) {
+  int sum = 0;
+  for (uint8_t t : fixed_point_kernel(sigma, radius)) {
+    sum += t;
+  }
+  return sum;
+}
+
+// Compares a same-size IIR blur with an unpadded FIR one of the given
+// radius, scaling the IIR result by the FIR kernel's gain. The FIR output
+// is truncated, so it is compared from the middle of its level.
+bool check_iir(const Buffer<uint8_t> &iir, const Buffer<uint8_t> &fir, float sigma, int radius) {
+  float sum = fixed_point_kernel_sum(sigma, radius) / 255.0f;
+  float gain = sum * sum;
+  double total = 0;
+  float worst = 0;
+  int within = 0;
+  fir.for_each_element([&](int x, int y) {
+    float d = fabsf(iir(x + radius, y + radius) * gain - (fir(x, y) + 0.5f));
+    total += d;
+    worst = std::max(worst, d);
+    within += d < 4;
+  });
+  int n = fir.width() * fir.height();
+  double mean = total / n;
+  bool ok = mean < 1.5 && within >= 0.95 * n;
+  printf("sigma %.1f: mean difference %.2f, max %.1f, %.1f%% within 4 levels%s\n",
+         sigma, mean, worst, 100.0 * within / n, ok ? "" : " (FAILED)");
+  return ok;
+}
+
+// Checks the recursive blur against the FIR ones at small sigma, then times
+// it against the separable FIR blur as sigma grows.
+int run_iir(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: ./run --iir in.png [iterations]\n");
+    return 0;
+  }
+
+  Buffer<uint8_t> input = load_image(argv[1]);
+  int timing_iterations = argc > 2 ? atoi(argv[2]) : 10;
+  printf("input: %s %d %d\n", argv[1], input.width(), input.height());
+
+  Buffer<uint8_t> iir(input.width(), input.height());
+  bool ok = true;
+  {
+    Buffer<uint8_t> fir(input.width() - 8, input.height() - 8);
+    gaussian_pipe(input, fir);
+    gaussian_iir(input, 1.5f, iir);
+    printf("against gaussian_pipe, ");
+    ok &= check_iir(iir, fir, 1.5f, 4);
+  }
+  for (float sigma : {1.0f, 2.0f, 3.0f}) {
+    int radius = (int)ceilf(3 * sigma);
+    Buffer<uint8_t> fir(input.width() - 2 * radius, input.height() - 2 * radius);
+    gaussian_separable(input, sigma, radius, fir);
+    gaussian_iir(input, sigma, iir);
+    printf("against gaussian_separable, ");
+    ok &= check_iir(iir, fir, sigma, radius);
+  }
+
+  // The separable blur takes radii up to 32.
+  for (float sigma : {1.5f, 3.0f, 5.0f, 10.0f, 20.0f, 50.0f}) {
+    double best = benchmark(timing_iterations, 1, [&]() {
+      gaussian_iir(input, sigma, iir);
+    });
+    printf("sigma %.1f:\tIIR %gms\t%.1f MP/s", sigma, best * 1e3, megapixels_per_second(iir, best));
+    int radius = (int)ceilf(3 * sigma);
+    if (radius <= 32) {
+      Buffer<uint8_t> fir(input.width() - 2 * radius, input.height() - 2 * radius);
+      best = benchmark(timing_iterations, 1, [&]() {
+        gaussian_separable(input, sigma, radius, fir);
+      });
+      printf("\tseparable FIR (radius %d) %gms\t%.1f MP/s", radius, best * 1e3, megapixels_per_second(fir, best));
+    }
+    printf("\n");
+  }
+
+  return ok ? 0 : -1;
+}
+
+// The frame with border pixels added on each side, repeating the edge
+// pixels or mirroring the ones inside them, as callers of gaussian_pipe do
+// to get a same-size result.
+Buffer<uint8_t> pad(const Buffer<uint8_t> &in, int border, bool mirror) {
+  int w = in.width(), h = in.height();
+  Buffer<uint8_t> out(w + 2 * border, h + 2 * border);
+  auto edge = [&](int i, int n) {
+    if (mirror) {
+      i = i < 0 ? -i : i;
+      return i >= n ? 2 * (n - 1) - i : i;
+    }
+    return std::min(std::max(i, 0), n - 1);
+  };
+  out.for_each_element([&](int x, int y) {
+    out(x, y) = in(edge(x - border, w), edge(y - border, h));
+  });
+  return out;
+}
+
+// Times the same-size blurs against padding the frame and running
+// gaussian_pipe, at the input's size and at twice that in each dimension
+// (4K for a 1080p input), and checks that they give the same result.
+int run_same_size(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: ./run --same-size in.png [iterations]\n");
+    return 0;
+  }
+
+  Buffer<uint8_t> input = load_image(argv[1]);
+  int timing_iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+  Buffer<uint8_t> doubled(input.width() * 2, input.height() * 2);
+  doubled.for_each_element([&](int x, int y) {
+    doubled(x, y) = input(x % input.width(), y % input.height());
+  });
+
+  int mismatches = 0;
+  for (Buffer<uint8_t> *frame : {&input, &doubled}) {
+    int w = frame->width(), h = frame->height();
+    printf("%dx%d:\n", w, h);
+    Buffer<uint8_t> out(w, h), padded_out(w, h);
+
+    // The padded frame is what callers pass today; the blur alone on it is
+    // the cost to beat.
+    Buffer<uint8_t> padded = pad(*frame, 4, false);
+    double kernel_only = benchmark(timing_iterations, 1, [&]() {
+      gaussian_pipe(padded, padded_out);
+    });
+    double best = benchmark(timing_iterations, 1, [&]() {
+      Buffer<uint8_t> p = pad(*frame, 4, false);
+      gaussian_pipe(p, padded_out);
+    });
+    printf("  pad + gaussian_pipe:\t%gms\t%.1f MP/s\n", best * 1e3, megapixels_per_second(out, best));
+    printf("  gaussian_pipe alone:\t%gms\t%.1f MP/s\n", kernel_only * 1e3, megapixels_per_second(out, kernel_only));
+
+    best = benchmark(timing_iterations, 1, [&]() {
+      gaussian_pipe_repeat_edge(*frame, out);
+    });
+    printf("  repeat edge:\t\t%gms\t%.1f MP/s\t(%+.1f%% on gaussian_pipe alone)\n",
+           best * 1e3, megapixels_per_second(out, best), (best / kernel_only - 1) * 100);
+    mismatches += count_mismatches(out, padded_out);
+
+    gaussian_pipe(pad(*frame, 4, true), padded_out);
+    best = benchmark(timing_iterations, 1, [&]() {
+      gaussian_pipe_mirror(*frame, out);
+    });
+    printf("  mirror:\t\t%gms\t%.1f MP/s\t(%+.1f%% on gaussian_pipe alone)\n",
+           best * 1e3, megapixels_per_second(out, best), (best / kernel_only - 1) * 100);
+    mismatches += count_mismatches(out, padded_out);
+  }
+
+  printf("same-size results differ from padding at %d pixels\n", mismatches);
+  return mismatches == 0 ? 0 : -1;
+}
+
+// Times the interleaved RGB and RGBA blurs against one gaussian_pipe call
+// per plane, with and without the copies between interleaved and planar
+// layouts, and checks they give the same result.
+int run_interleaved(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: ./run --interleaved in_rgb.png [iterations]\n");
+    return 0;
+  }
+
+  Buffer<uint8_t> input = load_image(argv[1]);
+  int timing_iterations = argc > 2 ? atoi(argv[2]) : 10;
+  int w = input.width(), h = input.height();
+  printf("input: %s %d %d %d\n", argv[1], w, h, input.channels());
+
+  int mismatches = 0;
+  for (int channels : {3, 4}) {
+    // The RGBA frame has an opaque alpha channel.
+    Buffer<uint8_t> planar(w, h, channels);
+    planar.for_each_element([&](int x, int y, int c) {
+      planar(x, y, c) = c < input.channels() ? input(x, y, c) : 255;
+    });
+    Buffer<uint8_t> interleaved = Buffer<uint8_t>::make_interleaved(w, h, channels);
+    interleaved.copy_from(planar);
+    Buffer<uint8_t> planar_out(w - 8, h - 8, channels);
+    Buffer<uint8_t> out = Buffer<uint8_t>::make_interleaved(w - 8, h - 8, channels);
+
+    auto blur_planes = [&]() {
+      for (int c = 0; c < channels; c++) {
+        Buffer<uint8_t> in_c = planar.sliced(2, c), out_c = planar_out.sliced(2, c);
+        gaussian_pipe(in_c, out_c);
+      }
+    };
+    double best = benchmark(timing_iterations, 1, blur_planes);
+    printf("%d channels:\n", channels);
+    printf("  %d planar calls:\t\t%gms\t%.1f MP/s\n", channels, best * 1e3, megapixels_per_second(out, best));
+    best = benchmark(timing_iterations, 1, [&]() {
+      planar.copy_from(interleaved);
+      blur_planes();
+      out.copy_from(planar_out);
+    });
+    printf("  split + planar + merge:\t%gms\t%.1f MP/s\n", best * 1e3, megapixels_per_second(out, best));
+
+    best = benchmark(timing_iterations, 1, [&]() {
+      if (channels == 3) {
+        gaussian_rgb(interleaved, out);
+      } else {
+        gaussian_rgba(interleaved, out);
+      }
+    });
+    printf("  interleaved:\t\t\t%gms\t%.1f MP/s\n", best * 1e3, megapixels_per_second(out, best));
+
+    out.for_each_element([&](int x, int y, int c) {
+      mismatches += out(x, y, c) != planar_out(x, y, c);
+    });
+  }
+
+  printf("interleaved results differ from planar at %d values\n", mismatches);
+  return mismatches == 0 ? 0 : -1;
+}
+
+// Times the eight level pyramid against building it from the host with a
+// blur and a decimation per level, and checks they give the same levels.
+int run_pyramid(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: ./run --pyramid in.png [iterations]\n");
+    return 0;
+  }
+
+  Buffer<uint8_t> input = load_image(argv[1]);
+  int timing_iterations = argc > 2 ? atoi(argv[2]) : 10;
+  printf("input: %s %d %d\n", argv[1], input.width(), input.height());
+
+  const int levels = 8;
+  std::vector<Buffer<uint8_t>> pyramid, expected;
+  for (int k = 1; k <= levels; k++) {
+    int w = (input.width() + (1 << k) - 1) >> k;
+    int h = (input.height() + (1 << k) - 1) >> k;
+    pyramid.emplace_back(w, h);
+    expected.emplace_back(w, h);
+  }
+
+  double best = benchmark(timing_iterations, 1, [&]() {
+    gaussian_pyramid(input, pyramid[0], pyramid[1], pyramid[2], pyramid[3],
+                     pyramid[4], pyramid[5], pyramid[6], pyramid[7]);
+  });
+  printf("gaussian_pyramid:\t\t%gms\n", best * 1e3);
+
+  // One blur per level, which keeps every pixel, then a decimation.
+  std::vector<Buffer<uint8_t>> blurred;
+  blurred.emplace_back(input.width(), input.height());
+  for (int k = 0; k + 1 < levels; k++) {
+    blurred.emplace_back(expected[k].width(), expected[k].height());
+  }
+  best = benchmark(timing_iterations, 1, [&]() {
+    for (int k = 0; k < levels; k++) {
+      gaussian_pipe_repeat_edge(k == 0 ? input : expected[k - 1], blurred[k]);
+      Buffer<uint8_t> &next = expected[k];
+      next.for_each_element([&](int x, int y) {
+        next(x, y) = blurred[k](2 * x, 2 * y);
+      });
+    }
+  });
+  printf("blur + decimate per level:\t%gms\n", best * 1e3);
+
+  int mismatches = 0;
+  for (int k = 0; k < levels; k++) {
+    int m = count_mismatches(pyramid[k], expected[k]);
+    printf("  level %d: %dx%d, %d mismatches\n", k + 1, pyramid[k].width(), pyramid[k].height(), m);
+    mismatches += m;
+  }
+  return mismatches == 0 ? 0 : -1;
+}
+
+// Three running-sum boxes of the given radius down each column of an 8.8
+// fixed point image, written transposed, as each half of gaussian_box does.
+Buffer<uint16_t> box_cols_transpose_reference(const Buffer<uint16_t> &in, int radius) {
+  int w = in.width(), h = in.height(), n = 2 * radius + 1;
+  Buffer<uint16_t> out(h, w);
+  std::vector<uint16_t> col(h), box(h);
+  for (int x = 0; x < w; x++) {
+    for (int y = 0; y < h; y++) {
+      col[y] = in(x, y);
+    }
+    for (int pass = 0; pass < 3; pass++) {
+      auto at = [&](int y) { return (uint32_t)col[std::min(std::max(y, 0), h - 1)]; };
+      uint32_t sum = 0;
+      for (int i = -radius; i <= radius; i++) {
+        sum += at(i);
+      }
+      for (int y = 0; y < h; y++) {
+        if (y > 0) {
+          sum += at(y + radius) - at(y - radius - 1);
+        }
+        box[y] = (uint16_t)((sum + n / 2) / n);
+      }
+      col.swap(box);
+    }
+    for (int y = 0; y < h; y++) {
+      out(y, x) = col[y];
+    }
+  }
+  return out;
+}
+
+// Checks the box filter against the scalar reference, times it as the radius
+// grows, and measures how far it is from a Gaussian of the same sigma.
+int run_box(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: ./run --box in.png [iterations]\n");
+    return 0;
+  }
+
+  Buffer<uint8_t> input = load_image(argv[1]);
+  int timing_iterations = argc > 2 ? atoi(argv[2]) : 10;
+  printf("input: %s %d %d\n", argv[1], input.width(), input.height());
+
+  Buffer<uint8_t> out(input.width(), input.height()), iir(input.width(), input.height());
+  Buffer<uint8_t> expected(input.width(), input.height());
+  Buffer<uint16_t> fixed(input.width(), input.height());
+  fixed.for_each_element([&](int x, int y) {
+    fixed(x, y) = input(x, y) << 8;
+  });
+
+  int mismatches = 0;
+  for (int radius : {2, 4, 8, 16, 32, 64, 128, 512}) {
+    double best = benchmark(timing_iterations, 1, [&]() {
+      gaussian_box(input, radius, out);
+    });
+
+    Buffer<uint16_t> ref = box_cols_transpose_reference(box_cols_transpose_reference(fixed, radius), radius);
+    expected.for_each_element([&](int x, int y) {
+      expected(x, y) = (ref(x, y) + 128) >> 8;
+    });
+    int m = count_mismatches(out, expected);
+    mismatches += m;
+
+    float sigma = sqrtf(radius * (radius + 1.0f));
+    gaussian_iir(input, sigma, iir);
+    double total = 0;
+    out.for_each_element([&](int x, int y) {
+      total += std::abs(out(x, y) - iir(x, y));
+    });
+
+    printf("radius %d (sigma %.1f):\t%gms\t%.1f MP/s\t%d mismatches\tmean %.2f from IIR Gaussian\n",
+           radius, sigma, best * 1e3, megapixels_per_second(out, best), m,
+           total / (out.width() * out.height()));
+  }
+
+  return mismatches == 0 ? 0 : -1;
+}
+
+// gaussian_pipe written plainly: the 81 taps of each output pixel in turn.
+void gaussian_pipe_reference(const Buffer<uint8_t> &in, Buffer<uint8_t> &out) {
+  std::vector<uint8_t> k = fixed_point_kernel(1.5f, 4);
+  for (int y = 0; y < out.height(); y++) {
+    for (int x = 0; x < out.width(); x++) {
+      uint32_t sum = 0;
+      for (int j = 0; j < 9; j++) {
+        for (int i = 0; i < 9; i++) {
+          sum += in(x + i, y + j) * k[i] * k[j];
+        }
+      }
+      out(x, y) = sum >> 16;
+    }
+  }
+}
+
+struct Timing {
+  double min, median;
+};
 
+// Runs op warmup times untimed, then times it samples times.
+Timing time_samples(int warmup, int samples, const std::function<void()> &op) {
+  for (int i = 0; i < warmup; i++) {
+    op();
+  }
+  std::vector<double> times;
+  for (int i = 0; i < samples; i++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    op();
+    auto end = std::chrono::high_resolution_clock::now();
+    times.push_back(std::chrono::duration<double>(end - start).count());
+  }
+  std::sort(times.begin(), times.end());
+  return {times.front(), times[times.size() / 2]};
+}
+
+// Times gaussian_pipe from VGA to 8K at thread counts from 1 to one per
+// core, and the scalar reference at each size, checking the outputs match.
+// The frames are the input tiled to each size.
+int run_bench(int argc, char **argv) {
   if (argc < 2) {
-    printf("Usage: ./run in.png \n");
+    printf("Usage: ./run --bench in.png [samples] [warmup]\n");
+    return 0;
+  }
+
+  Buffer<uint8_t> input = load_image(argv[1]);
+  int samples = argc > 2 ? atoi(argv[2]) : 20;
+  int warmup = argc > 3 ? atoi(argv[3]) : 3;
+
+  struct Resolution {
+    const char *name;
+    int width, height;
+  };
+  const Resolution resolutions[] = {
+      {"VGA", 640, 480},
+      {"720p", 1280, 720},
+      {"1080p", 1920, 1080},
+      {"4K", 3840, 2160},
+      {"8K", 7680, 4320},
+  };
+
+  // halide_set_num_threads sizes the runtime's own thread pool, so the
+  // sweep means nothing with the work-stealing pool installed.
+  std::vector<int> thread_counts;
+  int cores = std::max(1, (int)std::thread::hardware_concurrency());
+  if (getenv("HL_WORK_STEALING_POOL")) {
+    printf("HL_WORK_STEALING_POOL is set; timing its workers only\n");
+    thread_counts.push_back(0);
+  } else {
+    for (int n = 1; n < cores; n *= 2) {
+      thread_counts.push_back(n);
+    }
+    thread_counts.push_back(cores);
+  }
+
+  printf("%d samples after %d warmup runs\n", samples, warmup);
+  printf("%-6s %-10s %-8s %10s %10s %10s\n", "size", "", "threads", "min ms", "median ms", "MP/s");
+  int mismatches = 0;
+  for (const Resolution &r : resolutions) {
+    Buffer<uint8_t> frame(r.width + 8, r.height + 8);
+    frame.for_each_element([&](int x, int y) {
+      frame(x, y) = input(x % input.width(), y % input.height());
+    });
+    Buffer<uint8_t> out(r.width, r.height), expected(r.width, r.height);
+    double megapixels = r.width * r.height / 1e6;
+
+    for (int threads : thread_counts) {
+      if (threads > 0) {
+        halide_set_num_threads(threads);
+      }
+      Timing t = time_samples(warmup, samples, [&]() {
+        gaussian_pipe(frame, out);
+      });
+      printf("%-6s %-10s %-8d %10.3f %10.3f %10.1f\n", r.name, "halide", threads,
+             t.min * 1e3, t.median * 1e3, megapixels / t.min);
+    }
+
+    // The reference is slow enough that a few samples do.
+    Timing t = time_samples(std::min(warmup, 1), std::min(samples, 3), [&]() {
+      gaussian_pipe_reference(frame, expected);
+    });
+    int m = count_mismatches(out, expected);
+    printf("%-6s %-10s %-8d %10.3f %10.3f %10.1f  %s\n", r.name, "reference", 1,
+           t.min * 1e3, t.median * 1e3, megapixels / t.min,
+           m == 0 ? "outputs match" : "OUTPUTS DIFFER");
+    mismatches += m;
+  }
+  halide_set_num_threads(cores);
+
+  return mismatches == 0 ? 0 : -1;
+}
+
+int run_single(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: ./run in.png \n"
+           "       ./run --separable in.png [iterations]\n"
+           "       ./run --iir in.png [iterations]\n"
+           "       ./run --same-size in.png [iterations]\n"
+           "       ./run --interleaved in_rgb.png [iterations]\n"
+           "       ./run --pyramid in.png [iterations]\n"
+           "       ./run --box in.png [iterations]\n"
+           "       ./run --bench in.png [samples] [warmup]\n");
     return 0;
   }
 
@@ -30,3 +580,30 @@ int main(int argc, char **argv) {
   printf("finish running native code\n");
   return 0;
 }
+
+int main(int argc, char **argv) {
+  WorkStealingPool::install_from_env();
+
+  if (argc > 1 && strcmp(argv[1], "--separable") == 0) {
+    return run_separable(argc - 1, argv + 1);
+  }
+  if (argc > 1 && strcmp(argv[1], "--iir") == 0) {
+    return run_iir(argc - 1, argv + 1);
+  }
+  if (argc > 1 && strcmp(argv[1], "--same-size") == 0) {
+    return run_same_size(argc - 1, argv + 1);
+  }
+  if (argc > 1 && strcmp(argv[1], "--interleaved") == 0) {
+    return run_interleaved(argc - 1, argv + 1);
+  }
+  if (argc > 1 && strcmp(argv[1], "--pyramid") == 0) {
+    return run_pyramid(argc - 1, argv + 1);
+  }
+  if (argc > 1 && strcmp(argv[1], "--box") == 0) {
+    return run_box(argc - 1, argv + 1);
+  }
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+    return run_bench(argc - 1, argv + 1);
+  }
+  return run_single(argc, argv);
+}
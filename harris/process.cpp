@@ -8,12 +8,15 @@
 
 #include "HalideBuffer.h"
 #include "halide_image_io.h"
+#include "work_stealing_pool.h"
 
 using Halide::Runtime::Buffer;
 using namespace Halide::Tools;
 
 int main(int argc, char **argv)
 {
+  WorkStealingPool::install_from_env();
+
   // float k = 0.04;
   // float threshold = 100;
 
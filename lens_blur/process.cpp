@@ -7,11 +7,14 @@
 #include "halide_benchmark.h"
 #include "HalideBuffer.h"
 #include "halide_image_io.h"
+#include "work_stealing_pool.h"
 
 using namespace Halide::Runtime;
 using namespace Halide::Tools;
 
 int main(int argc, char **argv) {
+    WorkStealingPool::install_from_env();
+
     if (argc < 7) {
         printf("Usage: ./process input.png slices focus_depth blur_radius_scale aperture_samples timing_iterations output.png\n"
                "e.g.: ./process input.png 32 13 0.5 32 3 output.png\n");
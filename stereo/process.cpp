@@ -8,12 +8,15 @@
 
 #include "HalideBuffer.h"
 #include "halide_image_io.h"
+#include "work_stealing_pool.h"
 
 using Halide::Runtime::Buffer;
 using namespace Halide::Tools;
 
 int main(int argc, char **argv)
 {
+    WorkStealingPool::install_from_env();
+
     if (argc < 5)
     {
         printf("Usage: ./run left0224.png left-remap.png right0224.png "